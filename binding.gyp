@@ -1,18 +1,71 @@
 {
+	"variables": {
+		# Inflate cels with libdeflate instead of zlib: node-gyp rebuild --use_libdeflate=true
+		"use_libdeflate%": "false"
+	},
+	# The sources need C++17
 	"targets": [
 		{
 			"target_name": "aseprite-reader",
 			"cflags!": [ "-fno-exceptions" ],
 			"cflags_cc!": [ "-fno-exceptions" ],
+			"cflags_cc": [ "-std=c++17" ],
+			"xcode_settings": { "CLANG_CXX_LANGUAGE_STANDARD": "c++17" },
+			"msbuild_settings": { "ClCompile": { "LanguageStandard": "stdcpp17" } },
 			"sources": [
 				"./src/aseprite-reader.cpp",
+				"./src/aseprite-blend.cpp",
+				"./src/aseprite-blend-sse2.cpp",
+				"./src/aseprite-render.cpp",
+				"./src/aseprite-convert.cpp",
+				"./src/aseprite-atlas.cpp",
+				"./src/aseprite-stream.cpp",
+				"./src/mapped-file.cpp",
+				"./src/parse-cache.cpp",
+				"./src/xxhash64.cpp",
 				"./src/index.cpp"
 			],
 			"include_dirs": [
 				"./src",
 				"<!@(node -p \"require('node-addon-api').include\")"
 			],
-			'defines': [ 'NAPI_DISABLE_CPP_EXCEPTIONS' ]
+			'defines': [ 'NAPI_DISABLE_CPP_EXCEPTIONS' ],
+			"conditions": [
+				[ "target_arch=='x64' or target_arch=='ia32'", {
+					"dependencies": [ "aseprite-avx2" ],
+					'defines': [ 'ASEPRITE_AVX2' ]
+				} ],
+				[ "use_libdeflate=='true'", {
+					'defines': [ 'ASEPRITE_USE_LIBDEFLATE' ],
+					"libraries": [ "-ldeflate" ]
+				} ]
+			]
+		},
+		{
+			# AVX2 blend and palette kernels, only called after a runtime CPU check
+			"target_name": "aseprite-avx2",
+			"type": "static_library",
+			"cflags!": [ "-fno-exceptions" ],
+			"cflags_cc!": [ "-fno-exceptions" ],
+			"cflags_cc": [ "-std=c++17" ],
+			"xcode_settings": { "CLANG_CXX_LANGUAGE_STANDARD": "c++17" },
+			"msbuild_settings": { "ClCompile": { "LanguageStandard": "stdcpp17" } },
+			"sources": [
+				"./src/aseprite-blend-avx2.cpp",
+				"./src/aseprite-convert-avx2.cpp"
+			],
+			"include_dirs": [
+				"./src",
+				"<!@(node -p \"require('node-addon-api').include\")"
+			],
+			'defines': [ 'NAPI_DISABLE_CPP_EXCEPTIONS' ],
+			"conditions": [
+				[ "target_arch=='x64' or target_arch=='ia32'", {
+					"cflags": [ "-mavx2" ],
+					"xcode_settings": { "OTHER_CPLUSPLUSFLAGS": [ "-mavx2" ] },
+					"msvs_settings": { "VCCLCompilerTool": { "EnableEnhancedInstructionSet": "5" } }
+				} ]
+			]
 		}
 	]
 }
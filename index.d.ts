@@ -44,8 +44,24 @@ declare namespace AsepriteReader {
 		Divide = 18,
 	}
 
+	/** Bits of the tiles of tilemap cels, above the tile index */
+	export const enum TileFlags {
+		IndexMask = 0x1fffffff,
+		FlipX = 0x80000000,
+		FlipY = 0x40000000,
+		/** Swaps X and Y, before the other flips */
+		FlipDiagonal = 0x20000000,
+	}
+
 	export type Color = [number, number, number, number];
 
+	/**
+	 * Layout of cel and tileset pixels. `native` is the file's own, given by
+	 * `colorDepth`. 16 bit formats hold one value per pixel in host byte
+	 * order, `rgb565` without alpha.
+	 */
+	export type PixelFormat = 'native' | 'rgba' | 'bgra' | 'rgba-premultiplied' | 'rgb565' | 'rgba4444';
+
 	export interface Point {
 		x: number;
 		y: number;
@@ -63,6 +79,7 @@ declare namespace AsepriteReader {
 		height: number;
 		numFrames: number;
 		colorDepth: number;
+		pixelFormat: PixelFormat;
 		numColors: number;
 		pixelRatio: number;
 		palette: Palette;
@@ -71,6 +88,23 @@ declare namespace AsepriteReader {
 		layers: Layer[];
 		cels: Cel[];
 		slices: Slice[];
+		tilesets: Tileset[];
+		/** Only for loads with the `stats` option */
+		stats?: LoadStats;
+		/**
+		 * Flattens the visible layers of a frame into RGBA pixels
+		 * (width * height * 4 bytes), honoring layer order, visibility,
+		 * opacity and blend modes. Groups are flattened first, then blended
+		 * with their own opacity and blend mode when the file stores them.
+		 */
+		renderFrame(frameIndex: number, options?: RenderOptions): Uint8Array;
+	}
+
+	export interface RenderOptions {
+		/** Pixels are written here instead of a new array. Must hold width * height * 4 bytes */
+		target?: Uint8Array | Uint8ClampedArray;
+		/** Also draw hidden and reference layers */
+		includeHidden?: boolean;
 	}
 
 	export interface Frame {
@@ -88,6 +122,8 @@ declare namespace AsepriteReader {
 		blendMode: BlendMode;
 		children: Layer[];
 		layerParent?: Layer;
+		/** Tilemap layers only */
+		tileset?: Tileset;
 	}
 
 	export interface Cel {
@@ -98,7 +134,38 @@ declare namespace AsepriteReader {
 		opacity: number;
 		frame: Frame;
 		layer: Layer;
+		/** Frame index of the cel this one is linked to */
+		link?: number;
+		/** Not set by readAsepriteInfo. Tilemap cels hold 4 bytes per tile. */
 		pixels: Uint8Array;
+		/**
+		 * Tilemap cels only, not set for lazy loads: `w * h` tiles, the tile
+		 * index with TileFlags on top. `w` and `h` count tiles.
+		 */
+		tiles?: Uint32Array;
+		/** Only for lazy loads: drops the cached pixels, they are read again on next access */
+		releasePixels?(): void;
+		/**
+		 * The pixels as RGBA (w * h * 4 bytes): indexed cels go through the
+		 * palette, grayscale ones are expanded. RGBA cels return `pixels`.
+		 * Not set by readAsepriteInfo.
+		 */
+		toRGBA?(): Uint8Array | undefined;
+	}
+
+	export interface Tileset {
+		id: number;
+		name: string;
+		numTiles: number;
+		tileWidth: number;
+		tileHeight: number;
+		/** Index of the first tile in Aseprite's UI */
+		baseIndex: number;
+		/**
+		 * Tiles stacked vertically, tileWidth x (tileHeight * numTiles) pixels.
+		 * Not set by readAsepriteInfo or for tilesets in external files.
+		 */
+		pixels?: Uint8Array;
 	}
 
 	export interface Tag {
@@ -133,9 +200,389 @@ declare namespace AsepriteReader {
 		patch?: Rect;
 		pivot?: Point;
 	}
+
+	export interface ReadOptions {
+		/** Threads used to decompress cels, 0 = one per core. Defaults to 1. */
+		threads?: number;
+		/**
+		 * Leave cel data compressed in the buffer and read it on first access
+		 * of `Cel.pixels`. The buffer is kept alive and must not be modified.
+		 */
+		lazy?: boolean;
+		/**
+		 * Expand indexed and grayscale cels to RGBA while decoding them;
+		 * `colorDepth` is then 32. Ignored with `lazy`.
+		 */
+		rgba?: boolean;
+		/**
+		 * Convert cels and tilesets to this format while decoding them;
+		 * `pixelFormat` and `colorDepth` then describe it. Tilemap cels keep
+		 * their tiles. Only `native` and `rgba` results can be rendered or
+		 * expanded with `toRGBA`. Ignored with `lazy`.
+		 */
+		format?: PixelFormat;
+		/**
+		 * Cels with the same size and pixels share one copy of them, and one
+		 * `pixels` array. Ignored with `lazy` and by the stream parser.
+		 */
+		dedup?: boolean;
+		/** Measure the load into `Aseprite.stats`. Such loads skip the cache. */
+		stats?: boolean;
+		/** Return a CompactAseprite instead of the object graph. Turns `lazy` off. */
+		compact?: boolean;
+		/**
+		 * Only load the cels of these layers, a group selecting its children.
+		 * Other cels are never decoded and are left out; frames and layers are all kept.
+		 */
+		layers?: string | string[];
+		/** Only load the cels in the frames of these tags */
+		tags?: string | string[];
+		/** Only load the cels of frames first to last, both included. -1 as last: up to the last frame. */
+		frames?: [number, number];
+		/** Skip the cels of hidden layers (or in hidden groups) and reference layers */
+		visibleOnly?: boolean;
+	}
+
+	/** Columns of `CompactAseprite.layers`, `Stride` values per layer */
+	export const enum CompactLayer {
+		Type = 0,
+		Flags = 1,
+		Opacity = 2,
+		BlendMode = 3,
+		/** Layer index, -1 for none */
+		Parent = 4,
+		/** Index in `tilesets`, -1 for none */
+		Tileset = 5,
+		Stride = 6,
+	}
+
+	/** Columns of `CompactAseprite.cels`, `Stride` values per cel */
+	export const enum CompactCel {
+		X = 0,
+		Y = 1,
+		W = 2,
+		H = 3,
+		Opacity = 4,
+		Frame = 5,
+		Layer = 6,
+		/** Frame index of the linked cel, -1 for none */
+		Link = 7,
+		/** In `pixels`, -1 for none */
+		PixelOffset = 8,
+		PixelLength = 9,
+		Stride = 10,
+	}
+
+	/** Columns of `CompactAseprite.tags`, `Stride` values per tag */
+	export const enum CompactTag {
+		From = 0,
+		To = 1,
+		Direction = 2,
+		Stride = 3,
+	}
+
+	/** Columns of `CompactAseprite.sliceKeys`, `Stride` values per key */
+	export const enum CompactSliceKey {
+		Slice = 0,
+		Frame = 1,
+		X = 2,
+		Y = 3,
+		W = 4,
+		H = 5,
+		PatchX = 6,
+		PatchY = 7,
+		PatchW = 8,
+		PatchH = 9,
+		PivotX = 10,
+		PivotY = 11,
+		Stride = 12,
+	}
+
+	/** Bits of `CompactAseprite.sliceFlags` */
+	export const enum CompactSliceFlags {
+		Has9Slice = 1,
+		HasPivot = 2,
+	}
+
+	/** Columns of `CompactAseprite.tilesets`, `Stride` values per tileset */
+	export const enum CompactTileset {
+		Id = 0,
+		NumTiles = 1,
+		TileWidth = 2,
+		TileHeight = 3,
+		BaseIndex = 4,
+		/** In `pixels`, -1 for none */
+		PixelOffset = 5,
+		PixelLength = 6,
+		Stride = 7,
+	}
+
+	/**
+	 * The data of Aseprite in a constant number of JS objects: records are
+	 * rows of typed arrays (see the Compact* enums for their columns) and
+	 * reference each other by index.
+	 */
+	export interface CompactAseprite {
+		compact: true;
+		width: number;
+		height: number;
+		numFrames: number;
+		colorDepth: number;
+		pixelFormat: PixelFormat;
+		numColors: number;
+		pixelRatio: number;
+		/** Pixels of all cels and tilesets */
+		pixels: Uint8Array;
+		frameDurations: Uint16Array;
+		layers: Int32Array;
+		layerNames: string[];
+		cels: Int32Array;
+		tags: Int32Array;
+		/** 4 bytes per tag */
+		tagColors: Uint8Array;
+		tagNames: string[];
+		palette: { size: number; firstColor: number; lastColor: number; colors: Uint8Array };
+		sliceNames: string[];
+		/** CompactSliceFlags per slice */
+		sliceFlags: Uint8Array;
+		sliceKeys: Int32Array;
+		tilesets: Int32Array;
+		tilesetNames: string[];
+		stats?: LoadStats;
+		renderFrame(frameIndex: number, options?: RenderOptions): Uint8Array;
+	}
+
+	export type CompactOptions = ReadOptions & { compact: true };
+
+	export interface ChunkStats {
+		count: number;
+		/** Chunk headers included */
+		bytes: number;
+		/** Parsing only, cel data is decoded afterwards (see decodeMs) */
+		ms: number;
+	}
+
+	export interface LoadStats {
+		loadMs: number;
+		/** Decompression of cels and tilesets, wall time */
+		decodeMs: number;
+		/** Building the JS result, records left out as they are built on access */
+		objectMs: number;
+		compressedBytes: number;
+		/** What compressedBytes inflated to */
+		decompressedBytes: number;
+		/** decompressedBytes / compressedBytes, 0 without compressed data */
+		compressionRatio: number;
+		/** Native memory held by the file, pixels included */
+		nativeBytes: number;
+		/** With `dedup`, pixel bytes of the cels decoded */
+		celBytes: number;
+		/** What `dedup` saved of celBytes */
+		dedupBytes: number;
+		/** Cels sharing the pixels of another cel */
+		dedupCels: number;
+		/** celBytes / (celBytes - dedupBytes), 0 without `dedup` */
+		dedupRatio: number;
+		/** Objects and arrays created until the result was returned, records are built later on access */
+		jsObjects: number;
+		/** By chunk name (`layer`, `cel`, `palette`...), or hex type for unknown chunks */
+		chunks: { [name: string]: ChunkStats };
+	}
+
+	/** Parses the file on the libuv threadpool, leaving the event loop free. */
+	export function readAsepriteAsync(buffer: Uint8Array, options: CompactOptions): Promise<CompactAseprite>;
+	export function readAsepriteAsync(buffer: Uint8Array, options?: ReadOptions): Promise<Aseprite>;
+
+	export interface BatchOptions extends ReadOptions {
+		/** Files parsed at the same time, 0 = one per core. Defaults to 0. */
+		concurrency?: number;
+		/** Called with each result as soon as its file is parsed, in completion order. */
+		onResult?(result: BatchResult, index: number): void;
+	}
+
+	/** `aseprite` is a CompactAseprite with the `compact` option */
+	export type BatchResult = { aseprite: Aseprite | CompactAseprite; error?: undefined } | { aseprite?: undefined; error: Error };
+
+	/**
+	 * Parses buffers and file paths on a pool of native threads. Resolves with
+	 * one result per input, in input order; a file that fails to parse gets an
+	 * `error` instead of failing the batch.
+	 */
+	export function readAsepriteBatch(inputs: (Uint8Array | string)[], options?: BatchOptions): Promise<BatchResult[]>;
+
+	export interface FramesOptions extends ReadOptions {
+		/** From buildFrameIndex, for the same file. Built on the fly otherwise. */
+		index?: Uint8Array;
+	}
+
+	/**
+	 * Parses only what frames `first` to `last` (default `first`) need: the
+	 * first frame, the range and the frames its cels link to. Other frames
+	 * keep their duration but have no cels. Never cached.
+	 */
+	export function readAsepriteFrames(input: Uint8Array | string, first: number, last: number | undefined, options: FramesOptions & { compact: true }): CompactAseprite;
+	export function readAsepriteFrames(input: Uint8Array | string, first: number, last?: number, options?: FramesOptions): Aseprite;
+
+	/** Offsets, sizes, chunk counts and durations of the frames, serialized to store next to the file. */
+	export function buildFrameIndex(input: Uint8Array | string): Uint8Array;
+
+	export interface CacheOptions {
+		/** Memory the cache may hold, pixels included. 0 (the default) disables it. */
+		maxBytes?: number;
+	}
+
+	export interface CacheStats {
+		hits: number;
+		misses: number;
+		evictions: number;
+		entries: number;
+		bytes: number;
+		maxBytes: number;
+	}
+
+	/**
+	 * Keeps parsed files in memory, keyed by a hash of the buffer (or by path,
+	 * size and modification time), for the default export, readAsepriteAsync,
+	 * readAsepriteFile, readAsepriteFileAsync and readAsepriteBatch. Lazy loads are not cached.
+	 * Results of cache hits share their pixels: do not modify them.
+	 */
+	export function configureCache(options: CacheOptions): CacheStats;
+	export function cacheStats(): CacheStats;
+	export function clearCache(): void;
+
+	/** Same as `cel.toRGBA()` */
+	export function toRGBA(cel: Cel): Uint8Array | undefined;
+
+	/** Reads everything but the cel pixels, jumping over the pixel data. */
+	export function readAsepriteInfo(buffer: Uint8Array): Aseprite;
+
+	/** Parses the file at `path` through a read-only memory mapping. */
+	export function readAsepriteFile(path: string, options: CompactOptions): CompactAseprite;
+	export function readAsepriteFile(path: string, options?: ReadOptions): Aseprite;
+
+	/** Maps and parses the file at `path` on the libuv threadpool. */
+	export function readAsepriteFileAsync(path: string, options: CompactOptions): Promise<CompactAseprite>;
+	export function readAsepriteFileAsync(path: string, options?: ReadOptions): Promise<Aseprite>;
+
+	export interface StreamHeader {
+		width: number;
+		height: number;
+		/** Of the file, before any `format` conversion */
+		colorDepth: number;
+		/** Layout of the pixels in cel events */
+		pixelFormat: PixelFormat;
+		/** Bits per pixel of the pixels in cel events */
+		pixelDepth: number;
+		numFrames: number;
+		numColors: number;
+		pixelRatio: number;
+	}
+
+	export interface StreamLayer {
+		name: string;
+		index: number;
+		type: LayerType;
+		flags: LayerFlags;
+		opacity: number;
+		blendMode: BlendMode;
+		/** Index of the parent group layer */
+		parent?: number;
+		/** Tileset id of tilemap layers */
+		tilesetIndex?: number;
+	}
+
+	export interface StreamCel {
+		/** Frame index */
+		frame: number;
+		/** Layer index */
+		layer: number;
+		x: number;
+		y: number;
+		w: number;
+		h: number;
+		opacity: number;
+		link?: number;
+		/** Set for tilemap cels, whose pixels are tiles */
+		tilemap?: boolean;
+		pixels: Uint8Array;
+	}
+
+	export type StreamEvent =
+		| { type: 'header'; header: StreamHeader }
+		| { type: 'layer'; layer: StreamLayer }
+		| { type: 'cel'; cel: StreamCel }
+		| { type: 'frame'; index: number; frame: { duration: number } };
+
+	/** Push parser, fed with the file bytes in chunks of any size. */
+	export class AsepriteStreamParser {
+		/** `lazy` and the cel selection options are ignored */
+		constructor(options?: ReadOptions);
+		/** Parses the chunk and returns the events it completed. */
+		write(chunk: Uint8Array): StreamEvent[];
+		/** Throws if the file is incomplete. A CompactAseprite with the `compact` option. */
+		end(): Aseprite | CompactAseprite;
+	}
+
+	/**
+	 * Transform stream taking file bytes and emitting StreamEvent objects,
+	 * then `{ type: 'end', aseprite }`. Async iterable like any stream.
+	 */
+	export function createAsepriteStream(options?: ReadOptions): import('stream').Transform;
+
+	export interface AtlasOptions {
+		/** Page width and height limit. Defaults to 2048. */
+		maxSize?: number;
+		/** Empty pixels between images. Defaults to 0. */
+		padding?: number;
+		/** Crop frames to their alpha bounding box. Defaults to true. */
+		trim?: boolean;
+		/** Pack identical images once. Defaults to true. */
+		dedupe?: boolean;
+		/** Round page sizes up to powers of two. Defaults to true. */
+		powerOfTwo?: boolean;
+		/** Also draw hidden and reference layers. */
+		includeHidden?: boolean;
+		/** Sprites rendered in parallel, 0 = one per core. Defaults to 1. */
+		threads?: number;
+	}
+
+	export interface AtlasPage {
+		width: number;
+		height: number;
+		/** RGBA, width * height * 4 bytes */
+		pixels: Uint8Array;
+	}
+
+	export interface AtlasFrame {
+		page: number;
+		/** Rect in the page, w = h = 0 for empty trimmed frames */
+		frame: Rect;
+		rotated: false;
+		trimmed: boolean;
+		/** Rect of the image in the untrimmed frame */
+		spriteSourceSize: Rect;
+		sourceSize: { w: number; h: number };
+		duration: number;
+	}
+
+	export interface AtlasSprite {
+		frames: AtlasFrame[];
+		tags: Tag[];
+		slices: Slice[];
+	}
+
+	export interface Atlas {
+		pages: AtlasPage[];
+		/** In the order of the input */
+		sprites: AtlasSprite[];
+	}
+
+	/** Packs every frame of the given files into texture atlas pages. */
+	export function packAtlas(files: Aseprite[], options?: AtlasOptions): Atlas;
 }
 
-declare function AsepriteReader(buffer: Uint8Array): AsepriteReader.Aseprite;
+declare function AsepriteReader(buffer: Uint8Array, options: AsepriteReader.CompactOptions): AsepriteReader.CompactAseprite;
+declare function AsepriteReader(buffer: Uint8Array, options?: AsepriteReader.ReadOptions): AsepriteReader.Aseprite;
 
 export as namespace AsepriteReader;
 export = AsepriteReader;
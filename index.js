@@ -1,4 +1,50 @@
+const { Transform } = require('stream');
 const binding = require('bindings')('aseprite-reader');
 const reader = binding.AsepriteReader;
 
+// Transform stream: file bytes in, parse events out. The last event is
+// { type: 'end', aseprite } with the whole parsed file.
+function createAsepriteStream(options) {
+	const parser = new binding.AsepriteStreamParser(options);
+
+	return new Transform({
+		readableObjectMode: true,
+		transform(chunk, encoding, callback) {
+			try {
+				for (const event of parser.write(chunk)) this.push(event);
+				callback();
+			} catch (e) {
+				callback(e);
+			}
+		},
+		flush(callback) {
+			try {
+				this.push({ type: 'end', aseprite: parser.end() });
+				callback();
+			} catch (e) {
+				callback(e);
+			}
+		},
+	});
+}
+
+// Cel pixels as RGBA, whatever the color depth of the file
+function toRGBA(cel) {
+	return cel.toRGBA();
+}
+
 module.exports = reader;
+module.exports.readAsepriteAsync = binding.AsepriteReaderAsync;
+module.exports.readAsepriteInfo = binding.AsepriteReaderInfo;
+module.exports.packAtlas = binding.AsepritePackAtlas;
+module.exports.readAsepriteFile = binding.AsepriteReaderFile;
+module.exports.readAsepriteFileAsync = binding.AsepriteReaderFileAsync;
+module.exports.readAsepriteBatch = binding.AsepriteReaderBatch;
+module.exports.readAsepriteFrames = binding.AsepriteReaderFrames;
+module.exports.buildFrameIndex = binding.AsepriteFrameIndex;
+module.exports.AsepriteStreamParser = binding.AsepriteStreamParser;
+module.exports.createAsepriteStream = createAsepriteStream;
+module.exports.toRGBA = toRGBA;
+module.exports.configureCache = binding.AsepriteConfigureCache;
+module.exports.cacheStats = binding.AsepriteCacheStats;
+module.exports.clearCache = binding.AsepriteClearCache;
@@ -0,0 +1,98 @@
+/*
+ * arena.h
+ *
+ *  Record storage for the parsed document. Records are constructed in
+ *  place in blocks of growing size, so a file with thousands of cels needs
+ *  a handful of allocations, records sit next to each other in memory and
+ *  their addresses never change (cross references are plain pointers).
+ *  Everything is freed together with the arena.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class RecordArena final
+{
+public:
+	typedef typename std::vector<T *>::const_iterator const_iterator;
+
+	RecordArena() = default;
+	RecordArena(const RecordArena &) = delete;
+	RecordArena &operator=(const RecordArena &) = delete;
+	~RecordArena() { clear(); }
+
+	RecordArena(RecordArena &&other) noexcept { *this = std::move(other); }
+
+	RecordArena &operator=(RecordArena &&other) noexcept
+	{
+		if (this != &other)
+		{
+			clear();
+			blocks = std::move(other.blocks);
+			records = std::move(other.records);
+			used = other.used;
+			capacity = other.capacity;
+			other.blocks.clear();
+			other.records.clear();
+			other.used = other.capacity = 0;
+		}
+		return *this;
+	}
+
+	// Constructs a record at the end and returns it
+	T *emplace_back()
+	{
+		static_assert(alignof(T) <= alignof(std::max_align_t), "RecordArena does not support over-aligned records");
+
+		if (used == capacity)
+		{
+			capacity = std::min<size_t>(std::max<size_t>(MIN_BLOCK, records.size()), MAX_BLOCK);
+			blocks.emplace_back(::operator new(capacity * sizeof(T)));
+			used = 0;
+		}
+
+		T *record = new (static_cast<T *>(blocks.back().get()) + used) T();
+		used++;
+		records.push_back(record);
+		return record;
+	}
+
+	void clear()
+	{
+		for (T *record : records)
+			record->~T();
+
+		records.clear();
+		blocks.clear();
+		used = capacity = 0;
+	}
+
+	size_t size() const { return records.size(); }
+	bool empty() const { return records.empty(); }
+	T *const &operator[](size_t i) const { return records[i]; }
+	T *const &back() const { return records.back(); }
+	const_iterator begin() const { return records.begin(); }
+	const_iterator end() const { return records.end(); }
+
+private:
+	// Each block is as large as all the previous ones, within limits
+	static constexpr size_t MIN_BLOCK = 16;
+	static constexpr size_t MAX_BLOCK = 1024;
+
+	struct FreeBlock
+	{
+		void operator()(void *block) const { ::operator delete(block); }
+	};
+
+	std::vector<std::unique_ptr<void, FreeBlock>> blocks;
+	std::vector<T *> records; // in insertion order
+	size_t used = 0;
+	size_t capacity = 0;
+};
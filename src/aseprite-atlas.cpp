@@ -0,0 +1,381 @@
+/*
+ * aseprite-atlas.cpp
+ *
+ *  Texture atlas packing. Frames are rendered with renderFrame, cropped to
+ *  their alpha bounding box and hashed so identical images are packed
+ *  once. Images are placed tallest first with MaxRects (best short side
+ *  fit, preferring compact pages) into the first page with room.
+ */
+
+#include "aseprite-atlas.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace
+{
+	struct Image
+	{
+		std::vector<uint8_t> pixels;
+		int w = 0;
+		int h = 0;
+		uint64_t hash = 0;
+	};
+
+	struct Rect
+	{
+		int x, y, w, h;
+
+		bool contains(const Rect &r) const
+		{
+			return r.x >= x && r.y >= y && r.x + r.w <= x + w && r.y + r.h <= y + h;
+		}
+
+		bool intersects(const Rect &r) const
+		{
+			return r.x < x + w && r.x + r.w > x && r.y < y + h && r.y + r.h > y;
+		}
+	};
+
+	// MaxRects bin: keeps every maximal free rectangle. Each image goes where
+	// the used area stays smallest and squarest (so pages come out compact),
+	// ties go to the spot leaving the shortest leftover side.
+	class MaxRectsBin
+	{
+	public:
+		MaxRectsBin(int width, int height) { freeRects.push_back({0, 0, width, height}); }
+
+		bool insert(int w, int h, Rect &placed)
+		{
+			int bestExtent = INT32_MAX, bestShort = INT32_MAX;
+			bool found = false;
+
+			for (const Rect &free : freeRects)
+			{
+				if (w > free.w || h > free.h)
+					continue;
+
+				const int extent = std::max(std::max(usedW, free.x + w), std::max(usedH, free.y + h));
+				const int shortSide = std::min(free.w - w, free.h - h);
+
+				if (extent < bestExtent || (extent == bestExtent && shortSide < bestShort))
+				{
+					placed = {free.x, free.y, w, h};
+					bestExtent = extent;
+					bestShort = shortSide;
+					found = true;
+				}
+			}
+
+			if (!found)
+				return false;
+
+			usedW = std::max(usedW, placed.x + w);
+			usedH = std::max(usedH, placed.y + h);
+			split(placed);
+			prune();
+			return true;
+		}
+
+	private:
+		std::vector<Rect> freeRects;
+		int usedW = 0, usedH = 0;
+
+		// Replaces the free rects overlapping `used` by what is left around it
+		void split(const Rect &used)
+		{
+			const size_t count = freeRects.size();
+
+			for (size_t i = 0; i < count; i++)
+			{
+				const Rect free = freeRects[i];
+				if (!free.intersects(used))
+					continue;
+
+				if (used.x > free.x)
+					freeRects.push_back({free.x, free.y, used.x - free.x, free.h});
+				if (used.x + used.w < free.x + free.w)
+					freeRects.push_back({used.x + used.w, free.y, free.x + free.w - used.x - used.w, free.h});
+				if (used.y > free.y)
+					freeRects.push_back({free.x, free.y, free.w, used.y - free.y});
+				if (used.y + used.h < free.y + free.h)
+					freeRects.push_back({free.x, used.y + used.h, free.w, free.y + free.h - used.y - used.h});
+
+				freeRects[i].w = 0; // removed by prune
+			}
+		}
+
+		// Drops empty free rects and the ones inside another
+		void prune()
+		{
+			freeRects.erase(std::remove_if(freeRects.begin(), freeRects.end(), [](const Rect &r)
+										   { return r.w <= 0 || r.h <= 0; }),
+							freeRects.end());
+
+			for (size_t i = 0; i < freeRects.size(); i++)
+			{
+				for (size_t j = i + 1; j < freeRects.size();)
+				{
+					if (freeRects[i].contains(freeRects[j]))
+					{
+						freeRects.erase(freeRects.begin() + j);
+					}
+					else if (freeRects[j].contains(freeRects[i]))
+					{
+						freeRects.erase(freeRects.begin() + i);
+						j = i + 1;
+					}
+					else
+					{
+						j++;
+					}
+				}
+			}
+		}
+	};
+
+	uint64_t hashPixels(const uint8_t *data, size_t length)
+	{
+		uint64_t hash = 0xcbf29ce484222325ull;
+		size_t i = 0;
+
+		for (; i + 8 <= length; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, data + i, 8);
+			hash = (hash ^ word) * 0x100000001b3ull;
+			hash ^= hash >> 29;
+		}
+		for (; i < length; i++)
+			hash = (hash ^ data[i]) * 0x100000001b3ull;
+
+		return hash;
+	}
+
+	int ceilPowerOfTwo(int x)
+	{
+		int p = 1;
+		while (p < x)
+			p <<= 1;
+		return p;
+	}
+
+	int floorPowerOfTwo(int x)
+	{
+		int p = 1;
+		while (p * 2 <= x)
+			p <<= 1;
+		return p;
+	}
+
+	// Renders a frame and copies its (trimmed) image out of the canvas
+	void renderImage(AsepriteReader *reader, unsigned frameIndex, const AtlasOptions &options,
+					 std::vector<uint8_t> &canvas, Image &image, AtlasFrame &frame)
+	{
+		const int width = reader->file.width, height = reader->file.height;
+		reader->renderFrame(frameIndex, canvas.data(), options.includeHidden);
+
+		int x0 = 0, y0 = 0, x1 = width, y1 = height;
+
+		if (options.trim)
+		{
+			auto opaque = [&](int x, int y)
+			{ return canvas[((size_t)y * width + x) * 4 + 3] != 0; };
+			auto rowEmpty = [&](int y)
+			{
+				for (int x = 0; x < width; x++)
+					if (opaque(x, y))
+						return false;
+				return true;
+			};
+			auto columnEmpty = [&](int x)
+			{
+				for (int y = y0; y < y1; y++)
+					if (opaque(x, y))
+						return false;
+				return true;
+			};
+
+			while (y0 < y1 && rowEmpty(y0))
+				y0++;
+			while (y1 > y0 && rowEmpty(y1 - 1))
+				y1--;
+			while (x0 < x1 && y0 < y1 && columnEmpty(x0))
+				x0++;
+			while (x1 > x0 && y0 < y1 && columnEmpty(x1 - 1))
+				x1--;
+
+			if (y0 == y1)
+				x0 = x1 = y0 = y1 = 0;
+		}
+
+		image.w = x1 - x0;
+		image.h = y1 - y0;
+		image.pixels.resize((size_t)image.w * image.h * 4);
+
+		for (int y = 0; y < image.h; y++)
+			memcpy(image.pixels.data() + (size_t)y * image.w * 4, canvas.data() + ((size_t)(y0 + y) * width + x0) * 4, (size_t)image.w * 4);
+
+		image.hash = hashPixels(image.pixels.data(), image.pixels.size()) ^ ((uint64_t)image.w << 32 | (uint32_t)image.h);
+
+		frame.trimmed = image.w != width || image.h != height;
+		frame.sourceX = x0;
+		frame.sourceY = y0;
+		frame.sourceW = width;
+		frame.sourceH = height;
+		frame.w = image.w;
+		frame.h = image.h;
+	}
+}
+
+Atlas packAtlas(const std::vector<AsepriteReader *> &sprites, const AtlasOptions &options)
+{
+	Atlas atlas;
+
+	// Every frame gets a slot, sprites fill their own range
+	std::vector<size_t> firstFrame(sprites.size() + 1, 0);
+	for (size_t s = 0; s < sprites.size(); s++)
+		firstFrame[s + 1] = firstFrame[s] + sprites[s]->file.frames.size();
+
+	atlas.frames.resize(firstFrame.back());
+	std::vector<Image> images(atlas.frames.size());
+
+	// A sprite listed twice is rendered once: lazy cels decode on first use,
+	// which two threads must not do at the same time
+	std::vector<size_t> owner(sprites.size());
+	for (size_t s = 0; s < sprites.size(); s++)
+		owner[s] = std::find(sprites.begin(), sprites.begin() + s, sprites[s]) - sprites.begin();
+
+	// Frames of one sprite share cels, so each sprite is rendered by one thread
+	parallelFor(sprites.size(), options.threads, [&](size_t s)
+				{
+		if (owner[s] != s)
+			return;
+
+		AsepriteReader *reader = sprites[s];
+		std::vector<uint8_t> canvas((size_t)reader->file.width * reader->file.height * 4);
+
+		for (size_t f = 0; f < reader->file.frames.size(); f++)
+		{
+			AtlasFrame &frame = atlas.frames[firstFrame[s] + f];
+			frame.sprite = (unsigned)s;
+			frame.frame = (unsigned)f;
+			frame.duration = reader->file.frames[f]->duration;
+			frame.page = 0;
+			frame.x = frame.y = 0;
+			renderImage(reader, (unsigned)f, options, canvas, images[firstFrame[s] + f], frame);
+		} });
+
+	for (size_t s = 0; s < sprites.size(); s++)
+	{
+		if (owner[s] == s)
+			continue;
+
+		for (size_t f = 0; f < sprites[s]->file.frames.size(); f++)
+		{
+			atlas.frames[firstFrame[s] + f] = atlas.frames[firstFrame[owner[s]] + f];
+			atlas.frames[firstFrame[s] + f].sprite = (unsigned)s;
+			images[firstFrame[s] + f] = images[firstFrame[owner[s]] + f];
+		}
+	}
+
+	// Frames whose image is a copy of an earlier one point to it
+	std::vector<size_t> source(images.size());
+	std::unordered_map<uint64_t, std::vector<size_t>> byHash;
+	std::vector<size_t> unique;
+
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		source[i] = i;
+		if (!images[i].w)
+			continue;
+
+		if (options.dedupe)
+		{
+			std::vector<size_t> &candidates = byHash[images[i].hash];
+			for (size_t j : candidates)
+			{
+				if (images[j].w == images[i].w && images[j].h == images[i].h && images[j].pixels == images[i].pixels)
+				{
+					source[i] = j;
+					break;
+				}
+			}
+			if (source[i] != i)
+				continue;
+			candidates.push_back(i);
+		}
+
+		unique.push_back(i);
+	}
+
+	std::stable_sort(unique.begin(), unique.end(), [&](size_t a, size_t b)
+					 { return images[a].h != images[b].h ? images[a].h > images[b].h : images[a].w > images[b].w; });
+
+	// Padding is added to the right and bottom of each image, the bins are
+	// one padding larger so images can still touch the page edges
+	const int maxSize = options.powerOfTwo ? floorPowerOfTwo(options.maxSize) : (int)options.maxSize;
+	const int padding = (int)options.padding;
+	std::vector<MaxRectsBin> bins;
+
+	for (size_t i : unique)
+	{
+		const Image &image = images[i];
+		AtlasFrame &frame = atlas.frames[i];
+
+		if (image.w > maxSize || image.h > maxSize)
+			throw std::runtime_error("Frame " + std::to_string(frame.frame) + " of sprite " + std::to_string(frame.sprite) + " does not fit in a " + std::to_string(maxSize) + " pixels page");
+
+		Rect placed;
+		size_t page = 0;
+		while (page < bins.size() && !bins[page].insert(image.w + padding, image.h + padding, placed))
+			page++;
+
+		if (page == bins.size())
+		{
+			bins.emplace_back(maxSize + padding, maxSize + padding);
+			atlas.pages.push_back({0, 0, {}});
+			bins.back().insert(image.w + padding, image.h + padding, placed);
+		}
+
+		frame.page = (unsigned)page;
+		frame.x = placed.x;
+		frame.y = placed.y;
+		atlas.pages[page].width = std::max(atlas.pages[page].width, placed.x + image.w);
+		atlas.pages[page].height = std::max(atlas.pages[page].height, placed.y + image.h);
+	}
+
+	for (AtlasPage &page : atlas.pages)
+	{
+		if (options.powerOfTwo)
+		{
+			page.width = ceilPowerOfTwo(page.width);
+			page.height = ceilPowerOfTwo(page.height);
+		}
+		page.pixels.assign((size_t)page.width * page.height * 4, 0);
+	}
+
+	for (size_t i : unique)
+	{
+		const Image &image = images[i];
+		const AtlasFrame &frame = atlas.frames[i];
+		AtlasPage &page = atlas.pages[frame.page];
+
+		for (int y = 0; y < image.h; y++)
+			memcpy(page.pixels.data() + ((size_t)(frame.y + y) * page.width + frame.x) * 4, image.pixels.data() + (size_t)y * image.w * 4, (size_t)image.w * 4);
+	}
+
+	for (size_t i = 0; i < source.size(); i++)
+	{
+		if (source[i] == i)
+			continue;
+		atlas.frames[i].page = atlas.frames[source[i]].page;
+		atlas.frames[i].x = atlas.frames[source[i]].x;
+		atlas.frames[i].y = atlas.frames[source[i]].y;
+	}
+
+	return atlas;
+}
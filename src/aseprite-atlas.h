@@ -0,0 +1,57 @@
+/*
+ * aseprite-atlas.h
+ *
+ *  Texture atlas packing: renders every frame of one or more sprites,
+ *  trims and deduplicates the images and packs them into pages with a
+ *  MaxRects packer.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "aseprite-reader.h"
+
+struct AtlasOptions
+{
+	unsigned maxSize = 2048;	// page width and height limit
+	unsigned padding = 0;		// empty pixels between images
+	bool trim = true;			// crop frames to their alpha bounding box
+	bool dedupe = true;			// pack identical images once
+	bool powerOfTwo = true;		// round page sizes up to powers of two
+	bool includeHidden = false; // see AsepriteReader::renderFrame
+	unsigned threads = 1;		// sprites rendered in parallel, 0 = one per core
+};
+
+struct AtlasFrame
+{
+	unsigned sprite; // index in the input list
+	unsigned frame;
+	int duration; // ms
+
+	// Rect in the page, w = h = 0 for trimmed empty frames
+	unsigned page;
+	int x, y, w, h;
+
+	// Position of the rect in the untrimmed frame, and the frame size
+	bool trimmed;
+	int sourceX, sourceY;
+	int sourceW, sourceH;
+};
+
+struct AtlasPage
+{
+	int width;
+	int height;
+	std::vector<uint8_t> pixels; // RGBA
+};
+
+struct Atlas
+{
+	std::vector<AtlasPage> pages;
+	std::vector<AtlasFrame> frames; // by sprite, then frame
+};
+
+// Packs all frames of `sprites`. Throws std::runtime_error when an image
+// does not fit in a maxSize page.
+Atlas packAtlas(const std::vector<AsepriteReader *> &sprites, const AtlasOptions &options);
@@ -0,0 +1,55 @@
+/*
+ * aseprite-blend-avx2.cpp
+ *
+ *  AVX2 instantiation of the blend row kernels (8 pixels per step). Built
+ *  with AVX2 enabled (see binding.gyp) and only called after a CPU check.
+ */
+
+#include "aseprite-blend.h"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+#include "aseprite-blend-simd.h"
+
+struct AVX2Traits
+{
+	typedef __m256 F;
+	typedef __m256i I;
+	static const int N = 8;
+
+	static F set1(float v) { return _mm256_set1_ps(v); }
+	static F zero() { return _mm256_setzero_ps(); }
+	static F add(F a, F b) { return _mm256_add_ps(a, b); }
+	static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+	static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+	static F div(F a, F b) { return _mm256_div_ps(a, b); }
+	static F min(F a, F b) { return _mm256_min_ps(a, b); }
+	static F max(F a, F b) { return _mm256_max_ps(a, b); }
+	static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+	static F cmplt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	static F cmple(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	static F cmpgt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	static F cmpge(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+	static F cmpeq(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+	static F select(F mask, F a, F b) { return _mm256_blendv_ps(b, a, mask); }
+	static F trunc(F a) { return _mm256_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+	static F round(F a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+	static I loadu(const uint8_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+	static void storeu(uint8_t *p, I v) { _mm256_storeu_si256((__m256i *)p, v); }
+	static I set1i(int v) { return _mm256_set1_epi32(v); }
+	static I andi(I a, I b) { return _mm256_and_si256(a, b); }
+	static I ori(I a, I b) { return _mm256_or_si256(a, b); }
+	static I srli(I a, int n) { return _mm256_srli_epi32(a, n); }
+	static I slli(I a, int n) { return _mm256_slli_epi32(a, n); }
+	static F toF(I a) { return _mm256_cvtepi32_ps(a); }
+	static I toI(F a) { return _mm256_cvttps_epi32(a); }
+};
+
+int blendRowAVX2(AsepriteReader::BlendMode mode, uint8_t *dst, const uint8_t *src, int count, int opacity)
+{
+	return simdBlendRow<AVX2Traits>(mode, dst, src, count, opacity);
+}
+
+#endif
@@ -0,0 +1,480 @@
+/*
+ * aseprite-blend-simd.h
+ *
+ *  Vectorized blend row kernels, written once against a small "vector
+ *  traits" type and instantiated per instruction set by
+ *  aseprite-blend-sse2.cpp and aseprite-blend-avx2.cpp.
+ *
+ *  Pixels are processed V::N at a time as planes of floats holding the
+ *  0-255 channel values. Every integer step of the scalar blenders (MUL_UN8,
+ *  DIV_UN8, truncating divisions) is exact in single precision over that
+ *  range, so the separable modes match blendPixel exactly. Soft light and
+ *  the HSL modes use floats instead of doubles and may differ by 1.
+ *
+ *  Only include this from the instruction set translation units: every
+ *  function here is static, and nothing from the standard library is used,
+ *  so code built with wider instruction sets cannot leak into other
+ *  translation units through shared inline functions.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "aseprite-blend.h"
+
+template <typename V>
+struct SimdPixels
+{
+	typename V::F r, g, b, a;
+};
+
+template <typename V>
+static inline SimdPixels<V> simdUnpack(typename V::I p)
+{
+	const typename V::I mask = V::set1i(0xff);
+	SimdPixels<V> c;
+	c.r = V::toF(V::andi(p, mask));
+	c.g = V::toF(V::andi(V::srli(p, 8), mask));
+	c.b = V::toF(V::andi(V::srli(p, 16), mask));
+	c.a = V::toF(V::srli(p, 24));
+	return c;
+}
+
+template <typename V>
+static inline typename V::I simdPack(const SimdPixels<V> &c)
+{
+	return V::ori(
+		V::ori(V::toI(c.r), V::slli(V::toI(c.g), 8)),
+		V::ori(V::slli(V::toI(c.b), 16), V::slli(V::toI(c.a), 24)));
+}
+
+// x / 255 rounded, x integral in 0..255*255
+template <typename V>
+static inline typename V::F simdDiv255(typename V::F x)
+{
+	return V::round(V::mul(x, V::set1(1.0f / 255.0f)));
+}
+
+template <typename V>
+static inline typename V::F simdMulUn8(typename V::F a, typename V::F b)
+{
+	return simdDiv255<V>(V::mul(a, b));
+}
+
+// a * 255 / b with integer rounding, like DIV_UN8
+template <typename V>
+static inline typename V::F simdDivUn8(typename V::F a, typename V::F b)
+{
+	typedef typename V::F F;
+	F half = V::trunc(V::mul(b, V::set1(0.5f)));
+	return V::trunc(V::div(V::add(V::mul(a, V::set1(255.0f)), half), b));
+}
+
+// separable modes, b = backdrop channel, s = source channel
+
+struct SimdMultiply
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s) { return simdMulUn8<V>(b, s); }
+};
+
+struct SimdScreen
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s) { return V::sub(V::add(b, s), simdMulUn8<V>(b, s)); }
+};
+
+struct SimdDarken
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s) { return V::min(b, s); }
+};
+
+struct SimdLighten
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s) { return V::max(b, s); }
+};
+
+struct SimdDifference
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s) { return V::max(V::sub(b, s), V::sub(s, b)); }
+};
+
+struct SimdExclusion
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s)
+	{
+		typename V::F t = simdMulUn8<V>(b, s);
+		return V::sub(V::add(b, s), V::add(t, t));
+	}
+};
+
+struct SimdAddition
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s) { return V::min(V::add(b, s), V::set1(255.0f)); }
+};
+
+struct SimdSubtract
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s) { return V::max(V::sub(b, s), V::zero()); }
+};
+
+struct SimdHardLight
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s)
+	{
+		typedef typename V::F F;
+		F s2 = V::add(s, s);
+		F multiply = simdMulUn8<V>(b, s2);
+		F screen = SimdScreen::apply<V>(b, V::sub(s2, V::set1(255.0f)));
+		return V::select(V::cmplt(s, V::set1(128.0f)), multiply, screen);
+	}
+};
+
+struct SimdOverlay
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s) { return SimdHardLight::apply<V>(s, b); }
+};
+
+struct SimdColorDodge
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s)
+	{
+		typedef typename V::F F;
+		F is = V::sub(V::set1(255.0f), s);
+		F r = V::select(V::cmpge(b, is), V::set1(255.0f), simdDivUn8<V>(b, is));
+		return V::select(V::cmpeq(b, V::zero()), V::zero(), r);
+	}
+};
+
+struct SimdColorBurn
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s)
+	{
+		typedef typename V::F F;
+		F ib = V::sub(V::set1(255.0f), b);
+		F r = V::select(V::cmpge(ib, s), V::zero(), V::sub(V::set1(255.0f), simdDivUn8<V>(ib, s)));
+		return V::select(V::cmpeq(b, V::set1(255.0f)), V::set1(255.0f), r);
+	}
+};
+
+struct SimdSoftLight
+{
+	template <typename V>
+	static typename V::F apply(typename V::F ib, typename V::F is)
+	{
+		typedef typename V::F F;
+		const F one = V::set1(1.0f);
+		F b = V::mul(ib, V::set1(1.0f / 255.0f));
+		F s = V::mul(is, V::set1(1.0f / 255.0f));
+
+		F poly = V::mul(V::add(V::mul(V::sub(V::mul(V::set1(16.0f), b), V::set1(12.0f)), b), V::set1(4.0f)), b);
+		F d = V::select(V::cmple(b, V::set1(0.25f)), poly, V::sqrt(b));
+
+		F s2 = V::add(s, s);
+		F low = V::sub(b, V::mul(V::mul(V::sub(one, s2), b), V::sub(one, b)));
+		F high = V::add(b, V::mul(V::sub(s2, one), V::sub(d, b)));
+		F r = V::select(V::cmple(s, V::set1(0.5f)), low, high);
+
+		return V::trunc(V::add(V::mul(r, V::set1(255.0f)), V::set1(0.5f)));
+	}
+};
+
+struct SimdDivide
+{
+	template <typename V>
+	static typename V::F apply(typename V::F b, typename V::F s)
+	{
+		typedef typename V::F F;
+		F r = V::select(V::cmpge(b, s), V::set1(255.0f), simdDivUn8<V>(b, s));
+		return V::select(V::cmpeq(b, V::zero()), V::zero(), r);
+	}
+};
+
+template <typename Op>
+struct SimdSeparable
+{
+	template <typename V>
+	static void apply(const SimdPixels<V> &b, const SimdPixels<V> &s, SimdPixels<V> &out)
+	{
+		out.r = Op::template apply<V>(b.r, s.r);
+		out.g = Op::template apply<V>(b.g, s.g);
+		out.b = Op::template apply<V>(b.b, s.b);
+	}
+};
+
+// non-separable (HSL) modes, channels in 0..1
+
+template <typename V>
+static inline typename V::F simdLum(typename V::F r, typename V::F g, typename V::F b)
+{
+	return V::add(V::add(V::mul(r, V::set1(0.3f)), V::mul(g, V::set1(0.59f))), V::mul(b, V::set1(0.11f)));
+}
+
+template <typename V>
+static inline typename V::F simdSat(typename V::F r, typename V::F g, typename V::F b)
+{
+	return V::sub(V::max(r, V::max(g, b)), V::min(r, V::min(g, b)));
+}
+
+template <typename V>
+static inline void simdClipColor(typename V::F &r, typename V::F &g, typename V::F &b)
+{
+	typedef typename V::F F;
+	const F one = V::set1(1.0f);
+	F l = simdLum<V>(r, g, b);
+	F n = V::min(r, V::min(g, b));
+	F x = V::max(r, V::max(g, b));
+
+	F under = V::cmplt(n, V::zero());
+	F scale = V::div(l, V::sub(l, n));
+	r = V::select(under, V::add(l, V::mul(V::sub(r, l), scale)), r);
+	g = V::select(under, V::add(l, V::mul(V::sub(g, l), scale)), g);
+	b = V::select(under, V::add(l, V::mul(V::sub(b, l), scale)), b);
+
+	F over = V::cmpgt(x, one);
+	scale = V::div(V::sub(one, l), V::sub(x, l));
+	r = V::select(over, V::add(l, V::mul(V::sub(r, l), scale)), r);
+	g = V::select(over, V::add(l, V::mul(V::sub(g, l), scale)), g);
+	b = V::select(over, V::add(l, V::mul(V::sub(b, l), scale)), b);
+}
+
+template <typename V>
+static inline void simdSetLum(typename V::F &r, typename V::F &g, typename V::F &b, typename V::F l)
+{
+	typename V::F d = V::sub(l, simdLum<V>(r, g, b));
+	r = V::add(r, d);
+	g = V::add(g, d);
+	b = V::add(b, d);
+	simdClipColor<V>(r, g, b);
+}
+
+// Maps min -> 0, max -> s and mid in between, as SetSat does
+template <typename V>
+static inline void simdSetSat(typename V::F &r, typename V::F &g, typename V::F &b, typename V::F s)
+{
+	typedef typename V::F F;
+	F mn = V::min(r, V::min(g, b));
+	F mx = V::max(r, V::max(g, b));
+	F range = V::sub(mx, mn);
+	F valid = V::cmpgt(mx, mn);
+	F scale = V::div(s, range);
+	r = V::select(valid, V::mul(V::sub(r, mn), scale), V::zero());
+	g = V::select(valid, V::mul(V::sub(g, mn), scale), V::zero());
+	b = V::select(valid, V::mul(V::sub(b, mn), scale), V::zero());
+}
+
+template <typename V>
+static inline typename V::F simdToUn8(typename V::F v)
+{
+	return V::min(V::max(V::trunc(V::mul(v, V::set1(255.0f))), V::zero()), V::set1(255.0f));
+}
+
+template <typename V>
+static inline void simdToUnit(const SimdPixels<V> &c, typename V::F &r, typename V::F &g, typename V::F &b)
+{
+	const typename V::F k = V::set1(1.0f / 255.0f);
+	r = V::mul(c.r, k);
+	g = V::mul(c.g, k);
+	b = V::mul(c.b, k);
+}
+
+template <typename V>
+static inline void simdFromUnit(typename V::F r, typename V::F g, typename V::F b, SimdPixels<V> &out)
+{
+	out.r = simdToUn8<V>(r);
+	out.g = simdToUn8<V>(g);
+	out.b = simdToUn8<V>(b);
+}
+
+struct SimdHue
+{
+	template <typename V>
+	static void apply(const SimdPixels<V> &bd, const SimdPixels<V> &sc, SimdPixels<V> &out)
+	{
+		typename V::F r, g, b;
+		simdToUnit<V>(bd, r, g, b);
+		typename V::F s = simdSat<V>(r, g, b);
+		typename V::F l = simdLum<V>(r, g, b);
+
+		simdToUnit<V>(sc, r, g, b);
+		simdSetSat<V>(r, g, b, s);
+		simdSetLum<V>(r, g, b, l);
+		simdFromUnit<V>(r, g, b, out);
+	}
+};
+
+struct SimdSaturation
+{
+	template <typename V>
+	static void apply(const SimdPixels<V> &bd, const SimdPixels<V> &sc, SimdPixels<V> &out)
+	{
+		typename V::F r, g, b;
+		simdToUnit<V>(sc, r, g, b);
+		typename V::F s = simdSat<V>(r, g, b);
+
+		simdToUnit<V>(bd, r, g, b);
+		typename V::F l = simdLum<V>(r, g, b);
+		simdSetSat<V>(r, g, b, s);
+		simdSetLum<V>(r, g, b, l);
+		simdFromUnit<V>(r, g, b, out);
+	}
+};
+
+struct SimdColor
+{
+	template <typename V>
+	static void apply(const SimdPixels<V> &bd, const SimdPixels<V> &sc, SimdPixels<V> &out)
+	{
+		typename V::F r, g, b;
+		simdToUnit<V>(bd, r, g, b);
+		typename V::F l = simdLum<V>(r, g, b);
+
+		simdToUnit<V>(sc, r, g, b);
+		simdSetLum<V>(r, g, b, l);
+		simdFromUnit<V>(r, g, b, out);
+	}
+};
+
+struct SimdLuminosity
+{
+	template <typename V>
+	static void apply(const SimdPixels<V> &bd, const SimdPixels<V> &sc, SimdPixels<V> &out)
+	{
+		typename V::F r, g, b;
+		simdToUnit<V>(sc, r, g, b);
+		typename V::F l = simdLum<V>(r, g, b);
+
+		simdToUnit<V>(bd, r, g, b);
+		simdSetLum<V>(r, g, b, l);
+		simdFromUnit<V>(r, g, b, out);
+	}
+};
+
+struct SimdNormal
+{
+};
+
+// Aseprite's normal compositing of `s` over `b` at `opacity`
+template <typename V>
+static inline SimdPixels<V> simdComposite(const SimdPixels<V> &b, const SimdPixels<V> &s, typename V::F opacity)
+{
+	typedef typename V::F F;
+	F sa = simdMulUn8<V>(s.a, opacity);
+	F ra = V::sub(V::add(sa, b.a), simdMulUn8<V>(b.a, sa));
+
+	SimdPixels<V> r;
+	r.r = V::add(b.r, V::trunc(V::div(V::mul(V::sub(s.r, b.r), sa), ra)));
+	r.g = V::add(b.g, V::trunc(V::div(V::mul(V::sub(s.g, b.g), sa), ra)));
+	r.b = V::add(b.b, V::trunc(V::div(V::mul(V::sub(s.b, b.b), sa), ra)));
+	r.a = ra;
+
+	// transparent source keeps the backdrop
+	F keep = V::cmpeq(s.a, V::zero());
+	r.r = V::select(keep, b.r, r.r);
+	r.g = V::select(keep, b.g, r.g);
+	r.b = V::select(keep, b.b, r.b);
+	r.a = V::select(keep, b.a, r.a);
+
+	// transparent backdrop takes the source
+	F take = V::cmpeq(b.a, V::zero());
+	r.r = V::select(take, s.r, r.r);
+	r.g = V::select(take, s.g, r.g);
+	r.b = V::select(take, s.b, r.b);
+	r.a = V::select(take, sa, r.a);
+
+	return r;
+}
+
+template <typename V, typename Mode>
+struct SimdRow
+{
+	static void run(uint8_t *dst, const uint8_t *src, int count, int opacity, int &done)
+	{
+		typedef typename V::F F;
+		const F op = V::set1((float)opacity);
+		const F full = V::set1(255.0f);
+		int i = 0;
+
+		for (; i + V::N <= count; i += V::N, dst += V::N * 4, src += V::N * 4)
+		{
+			SimdPixels<V> b = simdUnpack<V>(V::loadu(dst));
+			SimdPixels<V> s = simdUnpack<V>(V::loadu(src));
+
+			SimdPixels<V> blended;
+			Mode::template apply<V>(b, s, blended);
+
+			// weight the blended color by backdrop alpha
+			F ib = V::sub(full, b.a);
+			s.r = simdDiv255<V>(V::add(V::mul(blended.r, b.a), V::mul(s.r, ib)));
+			s.g = simdDiv255<V>(V::add(V::mul(blended.g, b.a), V::mul(s.g, ib)));
+			s.b = simdDiv255<V>(V::add(V::mul(blended.b, b.a), V::mul(s.b, ib)));
+
+			V::storeu(dst, simdPack<V>(simdComposite<V>(b, s, op)));
+		}
+
+		done = i;
+	}
+};
+
+template <typename V>
+struct SimdRow<V, SimdNormal>
+{
+	static void run(uint8_t *dst, const uint8_t *src, int count, int opacity, int &done)
+	{
+		const typename V::F op = V::set1((float)opacity);
+		int i = 0;
+
+		for (; i + V::N <= count; i += V::N, dst += V::N * 4, src += V::N * 4)
+		{
+			SimdPixels<V> b = simdUnpack<V>(V::loadu(dst));
+			SimdPixels<V> s = simdUnpack<V>(V::loadu(src));
+			V::storeu(dst, simdPack<V>(simdComposite<V>(b, s, op)));
+		}
+
+		done = i;
+	}
+};
+
+// Blends as many whole vectors of pixels as fit in `count` and returns how
+// many pixels were done; the caller finishes the row with blendPixel.
+template <typename V>
+static int simdBlendRow(AsepriteReader::BlendMode mode, uint8_t *dst, const uint8_t *src, int count, int opacity)
+{
+	typedef AsepriteReader::BlendMode BlendMode;
+	int done = 0;
+
+	switch (mode)
+	{
+	case BlendMode::MULTIPLY: SimdRow<V, SimdSeparable<SimdMultiply>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::SCREEN: SimdRow<V, SimdSeparable<SimdScreen>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::OVERLAY: SimdRow<V, SimdSeparable<SimdOverlay>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::DARKEN: SimdRow<V, SimdSeparable<SimdDarken>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::LIGHTEN: SimdRow<V, SimdSeparable<SimdLighten>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::COLOR_DODGE: SimdRow<V, SimdSeparable<SimdColorDodge>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::COLOR_BURN: SimdRow<V, SimdSeparable<SimdColorBurn>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::HARD_LIGHT: SimdRow<V, SimdSeparable<SimdHardLight>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::SOFT_LIGHT: SimdRow<V, SimdSeparable<SimdSoftLight>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::DIFFERENCE: SimdRow<V, SimdSeparable<SimdDifference>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::EXCLUSION: SimdRow<V, SimdSeparable<SimdExclusion>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::HUE: SimdRow<V, SimdHue>::run(dst, src, count, opacity, done); break;
+	case BlendMode::SATURATION: SimdRow<V, SimdSaturation>::run(dst, src, count, opacity, done); break;
+	case BlendMode::COLOR: SimdRow<V, SimdColor>::run(dst, src, count, opacity, done); break;
+	case BlendMode::LUMINOSITY: SimdRow<V, SimdLuminosity>::run(dst, src, count, opacity, done); break;
+	case BlendMode::ADDITION: SimdRow<V, SimdSeparable<SimdAddition>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::SUBTRACT: SimdRow<V, SimdSeparable<SimdSubtract>>::run(dst, src, count, opacity, done); break;
+	case BlendMode::DIVIDE: SimdRow<V, SimdSeparable<SimdDivide>>::run(dst, src, count, opacity, done); break;
+	default: SimdRow<V, SimdNormal>::run(dst, src, count, opacity, done); break;
+	}
+
+	return done;
+}
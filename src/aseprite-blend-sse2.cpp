@@ -0,0 +1,54 @@
+/*
+ * aseprite-blend-sse2.cpp
+ *
+ *  SSE2 instantiation of the blend row kernels (4 pixels per step).
+ */
+
+#include "aseprite-blend.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+#include "aseprite-blend-simd.h"
+
+struct SSE2Traits
+{
+	typedef __m128 F;
+	typedef __m128i I;
+	static const int N = 4;
+
+	static F set1(float v) { return _mm_set1_ps(v); }
+	static F zero() { return _mm_setzero_ps(); }
+	static F add(F a, F b) { return _mm_add_ps(a, b); }
+	static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+	static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+	static F div(F a, F b) { return _mm_div_ps(a, b); }
+	static F min(F a, F b) { return _mm_min_ps(a, b); }
+	static F max(F a, F b) { return _mm_max_ps(a, b); }
+	static F sqrt(F a) { return _mm_sqrt_ps(a); }
+	static F cmplt(F a, F b) { return _mm_cmplt_ps(a, b); }
+	static F cmple(F a, F b) { return _mm_cmple_ps(a, b); }
+	static F cmpgt(F a, F b) { return _mm_cmpgt_ps(a, b); }
+	static F cmpge(F a, F b) { return _mm_cmpge_ps(a, b); }
+	static F cmpeq(F a, F b) { return _mm_cmpeq_ps(a, b); }
+	static F select(F mask, F a, F b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+	static F trunc(F a) { return _mm_cvtepi32_ps(_mm_cvttps_epi32(a)); }
+	static F round(F a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+
+	static I loadu(const uint8_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+	static void storeu(uint8_t *p, I v) { _mm_storeu_si128((__m128i *)p, v); }
+	static I set1i(int v) { return _mm_set1_epi32(v); }
+	static I andi(I a, I b) { return _mm_and_si128(a, b); }
+	static I ori(I a, I b) { return _mm_or_si128(a, b); }
+	static I srli(I a, int n) { return _mm_srli_epi32(a, n); }
+	static I slli(I a, int n) { return _mm_slli_epi32(a, n); }
+	static F toF(I a) { return _mm_cvtepi32_ps(a); }
+	static I toI(F a) { return _mm_cvttps_epi32(a); }
+};
+
+int blendRowSSE2(AsepriteReader::BlendMode mode, uint8_t *dst, const uint8_t *src, int count, int opacity)
+{
+	return simdBlendRow<SSE2Traits>(mode, dst, src, count, opacity);
+}
+
+#endif
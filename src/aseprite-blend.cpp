@@ -0,0 +1,399 @@
+/*
+ * aseprite-blend.cpp
+ *
+ *  Scalar blend functions. The separable modes and the HSL modes are the
+ *  ones from Aseprite's doc/blend_funcs.cpp. The blended color is mixed
+ *  with the source color by the backdrop alpha before compositing (as in
+ *  the W3C compositing spec), which gives Aseprite's result on opaque
+ *  backdrops and plain normal blending on transparent ones.
+ */
+
+#include "aseprite-blend.h"
+#include "cpu-features.h"
+
+#include <algorithm>
+#include <cmath>
+
+typedef AsepriteReader::BlendMode BlendMode;
+
+static const uint32_t RGB_MASK = 0x00ffffff;
+static const uint32_t A_MASK = 0xff000000;
+
+static inline int getr(uint32_t c) { return c & 0xff; }
+static inline int getg(uint32_t c) { return (c >> 8) & 0xff; }
+static inline int getb(uint32_t c) { return (c >> 16) & 0xff; }
+static inline int geta(uint32_t c) { return (c >> 24) & 0xff; }
+
+static inline uint32_t rgba(int r, int g, int b, int a)
+{
+	return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) | ((uint32_t)a << 24);
+}
+
+// a * 255 / b, rounded like Aseprite's DIV_UN8
+static inline int divUn8(int a, int b)
+{
+	return (a * 0xff + (b / 2)) / b;
+}
+
+// separable blend functions, b = backdrop, s = source
+
+static int blendMultiply(int b, int s) { return mulUn8(b, s); }
+static int blendScreen(int b, int s) { return b + s - mulUn8(b, s); }
+static int blendDarken(int b, int s) { return std::min(b, s); }
+static int blendLighten(int b, int s) { return std::max(b, s); }
+static int blendDifference(int b, int s) { return std::abs(b - s); }
+static int blendExclusion(int b, int s) { return b + s - 2 * mulUn8(b, s); }
+static int blendAddition(int b, int s) { return std::min(b + s, 255); }
+static int blendSubtract(int b, int s) { return std::max(b - s, 0); }
+
+static int blendHardLight(int b, int s)
+{
+	if (s < 128)
+		return blendMultiply(b, s << 1);
+	else
+		return blendScreen(b, (s << 1) - 255);
+}
+
+static int blendOverlay(int b, int s)
+{
+	return blendHardLight(s, b);
+}
+
+static int blendColorDodge(int b, int s)
+{
+	if (b == 0)
+		return 0;
+
+	s = 255 - s;
+	if (b >= s)
+		return 255;
+	else
+		return divUn8(b, s); // b / (1 - s)
+}
+
+static int blendColorBurn(int b, int s)
+{
+	if (b == 255)
+		return 255;
+
+	b = 255 - b;
+	if (b >= s)
+		return 0;
+	else
+		return 255 - divUn8(b, s); // 1 - ((1 - b) / s)
+}
+
+static int blendSoftLight(int ib, int is)
+{
+	double b = ib / 255.0;
+	double s = is / 255.0;
+	double r, d;
+
+	if (b <= 0.25)
+		d = ((16 * b - 12) * b + 4) * b;
+	else
+		d = std::sqrt(b);
+
+	if (s <= 0.5)
+		r = b - (1.0 - 2.0 * s) * b * (1.0 - b);
+	else
+		r = b + (2.0 * s - 1.0) * (d - b);
+
+	return (int)(r * 255 + 0.5);
+}
+
+static int blendDivide(int b, int s)
+{
+	if (b == 0)
+		return 0;
+	else if (b >= s)
+		return 255;
+	else
+		return divUn8(b, s); // b / s
+}
+
+// non-separable (HSL) helpers, channels in 0..1
+
+static double lum(double r, double g, double b)
+{
+	return 0.3 * r + 0.59 * g + 0.11 * b;
+}
+
+static double sat(double r, double g, double b)
+{
+	return std::max(r, std::max(g, b)) - std::min(r, std::min(g, b));
+}
+
+static void clipColor(double &r, double &g, double &b)
+{
+	double l = lum(r, g, b);
+	double n = std::min(r, std::min(g, b));
+	double x = std::max(r, std::max(g, b));
+
+	if (n < 0)
+	{
+		r = l + (((r - l) * l) / (l - n));
+		g = l + (((g - l) * l) / (l - n));
+		b = l + (((b - l) * l) / (l - n));
+	}
+
+	if (x > 1)
+	{
+		r = l + (((r - l) * (1 - l)) / (x - l));
+		g = l + (((g - l) * (1 - l)) / (x - l));
+		b = l + (((b - l) * (1 - l)) / (x - l));
+	}
+}
+
+static void setLum(double &r, double &g, double &b, double l)
+{
+	double d = l - lum(r, g, b);
+	r += d;
+	g += d;
+	b += d;
+	clipColor(r, g, b);
+}
+
+static void setSat(double &r, double &g, double &b, double s)
+{
+	double *min = &r, *mid = &g, *max = &b;
+	if (*min > *mid)
+		std::swap(min, mid);
+	if (*mid > *max)
+		std::swap(mid, max);
+	if (*min > *mid)
+		std::swap(min, mid);
+
+	if (*max > *min)
+	{
+		*mid = ((*mid - *min) * s) / (*max - *min);
+		*max = s;
+	}
+	else
+	{
+		*mid = *max = 0;
+	}
+	*min = 0;
+}
+
+static inline int toUn8(double v)
+{
+	return std::min(std::max((int)(255.0 * v), 0), 255);
+}
+
+// compositing
+
+static uint32_t blendNormal(uint32_t backdrop, uint32_t src, int opacity)
+{
+	if ((backdrop & A_MASK) == 0)
+	{
+		int a = mulUn8(geta(src), opacity);
+		return (src & RGB_MASK) | ((uint32_t)a << 24);
+	}
+	else if ((src & A_MASK) == 0)
+	{
+		return backdrop;
+	}
+
+	const int Br = getr(backdrop);
+	const int Bg = getg(backdrop);
+	const int Bb = getb(backdrop);
+	const int Ba = geta(backdrop);
+
+	const int Sr = getr(src);
+	const int Sg = getg(src);
+	const int Sb = getb(src);
+	const int Sa = mulUn8(geta(src), opacity);
+
+	const int Ra = Sa + Ba - mulUn8(Ba, Sa);
+	const int Rr = Br + (Sr - Br) * Sa / Ra;
+	const int Rg = Bg + (Sg - Bg) * Sa / Ra;
+	const int Rb = Bb + (Sb - Bb) * Sa / Ra;
+
+	return rgba(Rr, Rg, Rb, Ra);
+}
+
+// Replaces the source color by the blended one, weighted by backdrop alpha,
+// then composites it normally
+static inline uint32_t mixAndComposite(uint32_t backdrop, uint32_t src, int r, int g, int b, int opacity)
+{
+	const int Ba = geta(backdrop);
+	r = div255(r * Ba + getr(src) * (255 - Ba));
+	g = div255(g * Ba + getg(src) * (255 - Ba));
+	b = div255(b * Ba + getb(src) * (255 - Ba));
+	return blendNormal(backdrop, rgba(r, g, b, geta(src)), opacity);
+}
+
+template <int (*fn)(int, int)>
+static uint32_t blendSeparable(uint32_t backdrop, uint32_t src, int opacity)
+{
+	return mixAndComposite(
+		backdrop, src,
+		fn(getr(backdrop), getr(src)),
+		fn(getg(backdrop), getg(src)),
+		fn(getb(backdrop), getb(src)),
+		opacity);
+}
+
+static uint32_t blendHue(uint32_t backdrop, uint32_t src, int opacity)
+{
+	double r = getr(backdrop) / 255.0;
+	double g = getg(backdrop) / 255.0;
+	double b = getb(backdrop) / 255.0;
+	double s = sat(r, g, b);
+	double l = lum(r, g, b);
+
+	r = getr(src) / 255.0;
+	g = getg(src) / 255.0;
+	b = getb(src) / 255.0;
+
+	setSat(r, g, b, s);
+	setLum(r, g, b, l);
+
+	return mixAndComposite(backdrop, src, toUn8(r), toUn8(g), toUn8(b), opacity);
+}
+
+static uint32_t blendSaturation(uint32_t backdrop, uint32_t src, int opacity)
+{
+	double r = getr(src) / 255.0;
+	double g = getg(src) / 255.0;
+	double b = getb(src) / 255.0;
+	double s = sat(r, g, b);
+
+	r = getr(backdrop) / 255.0;
+	g = getg(backdrop) / 255.0;
+	b = getb(backdrop) / 255.0;
+	double l = lum(r, g, b);
+
+	setSat(r, g, b, s);
+	setLum(r, g, b, l);
+
+	return mixAndComposite(backdrop, src, toUn8(r), toUn8(g), toUn8(b), opacity);
+}
+
+static uint32_t blendColor(uint32_t backdrop, uint32_t src, int opacity)
+{
+	double r = getr(backdrop) / 255.0;
+	double g = getg(backdrop) / 255.0;
+	double b = getb(backdrop) / 255.0;
+	double l = lum(r, g, b);
+
+	r = getr(src) / 255.0;
+	g = getg(src) / 255.0;
+	b = getb(src) / 255.0;
+
+	setLum(r, g, b, l);
+
+	return mixAndComposite(backdrop, src, toUn8(r), toUn8(g), toUn8(b), opacity);
+}
+
+static uint32_t blendLuminosity(uint32_t backdrop, uint32_t src, int opacity)
+{
+	double r = getr(src) / 255.0;
+	double g = getg(src) / 255.0;
+	double b = getb(src) / 255.0;
+	double l = lum(r, g, b);
+
+	r = getr(backdrop) / 255.0;
+	g = getg(backdrop) / 255.0;
+	b = getb(backdrop) / 255.0;
+
+	setLum(r, g, b, l);
+
+	return mixAndComposite(backdrop, src, toUn8(r), toUn8(g), toUn8(b), opacity);
+}
+
+typedef uint32_t (*PixelBlender)(uint32_t backdrop, uint32_t src, int opacity);
+
+// Indexed by BlendMode
+static const PixelBlender BLENDERS[] = {
+	blendNormal,
+	blendSeparable<blendMultiply>,
+	blendSeparable<blendScreen>,
+	blendSeparable<blendOverlay>,
+	blendSeparable<blendDarken>,
+	blendSeparable<blendLighten>,
+	blendSeparable<blendColorDodge>,
+	blendSeparable<blendColorBurn>,
+	blendSeparable<blendHardLight>,
+	blendSeparable<blendSoftLight>,
+	blendSeparable<blendDifference>,
+	blendSeparable<blendExclusion>,
+	blendHue,
+	blendSaturation,
+	blendColor,
+	blendLuminosity,
+	blendSeparable<blendAddition>,
+	blendSeparable<blendSubtract>,
+	blendSeparable<blendDivide>,
+};
+
+static PixelBlender getBlender(BlendMode mode)
+{
+	const unsigned index = (unsigned)mode;
+	return index < sizeof(BLENDERS) / sizeof(BLENDERS[0]) ? BLENDERS[index] : blendNormal;
+}
+
+uint32_t blendPixel(BlendMode mode, uint32_t backdrop, uint32_t src, int opacity)
+{
+	return getBlender(mode)(backdrop, src, opacity);
+}
+
+void blendRowScalar(BlendMode mode, uint8_t *dst, const uint8_t *src, int count, int opacity)
+{
+	const PixelBlender blender = getBlender(mode);
+
+	for (int i = 0; i < count; i++, dst += 4, src += 4)
+	{
+		uint32_t result = blender(rgba(dst[0], dst[1], dst[2], dst[3]), rgba(src[0], src[1], src[2], src[3]), opacity);
+		dst[0] = getr(result);
+		dst[1] = getg(result);
+		dst[2] = getb(result);
+		dst[3] = geta(result);
+	}
+}
+
+// Vector kernels blend whole vectors of pixels and return how many they did
+typedef int (*RowKernel)(BlendMode mode, uint8_t *dst, const uint8_t *src, int count, int opacity);
+
+#ifdef ASEPRITE_SSE2
+int blendRowSSE2(BlendMode mode, uint8_t *dst, const uint8_t *src, int count, int opacity);
+#endif
+
+#if defined(ASEPRITE_X86) && defined(ASEPRITE_AVX2)
+int blendRowAVX2(BlendMode mode, uint8_t *dst, const uint8_t *src, int count, int opacity);
+#endif
+
+struct RowKernelInfo
+{
+	RowKernel kernel;
+	const char *name;
+};
+
+static RowKernelInfo selectRowKernel()
+{
+#if defined(ASEPRITE_X86) && defined(ASEPRITE_AVX2)
+	if (cpuHasAVX2())
+		return {blendRowAVX2, "avx2"};
+#endif
+#ifdef ASEPRITE_SSE2
+	return {blendRowSSE2, "sse2"};
+#else
+	return {nullptr, "scalar"};
+#endif
+}
+
+static const RowKernelInfo rowKernel = selectRowKernel();
+
+const char *blendRowKernel()
+{
+	return rowKernel.name;
+}
+
+void blendRow(BlendMode mode, uint8_t *dst, const uint8_t *src, int count, int opacity)
+{
+	int done = rowKernel.kernel ? rowKernel.kernel(mode, dst, src, count, opacity) : 0;
+
+	if (done < count)
+		blendRowScalar(mode, dst + done * 4, src + done * 4, count - done, opacity);
+}
@@ -0,0 +1,43 @@
+/*
+ * aseprite-blend.h
+ *
+ *  Pixel blending for every AsepriteReader::BlendMode, following the
+ *  formulas of Aseprite's doc/blend_funcs.cpp.
+ *
+ *  Pixels are RGBA8 in memory order (R first). Rows are composited with
+ *  the layer blend mode, then merged with Aseprite's "normal" compositing
+ *  at the given opacity.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "aseprite-reader.h"
+
+// x / 255 rounded to nearest, for 0 <= x <= 255 * 255
+inline int div255(int x)
+{
+	x += 0x80;
+	return ((x >> 8) + x) >> 8;
+}
+
+// a * b / 255, rounded like Aseprite's MUL_UN8
+inline int mulUn8(int a, int b)
+{
+	return div255(a * b);
+}
+
+// Blends a single pixel of `src` over `backdrop`. Colors are packed with R
+// in the low byte and A in the high byte.
+uint32_t blendPixel(AsepriteReader::BlendMode mode, uint32_t backdrop, uint32_t src, int opacity);
+
+// Blends `count` RGBA pixels of `src` over `dst`, in place, using the
+// fastest row kernel the CPU supports (see blendRowKernel). Results are
+// within 1 of blendRowScalar on every channel.
+void blendRow(AsepriteReader::BlendMode mode, uint8_t *dst, const uint8_t *src, int count, int opacity);
+
+// Reference implementation of blendRow, one pixel at a time
+void blendRowScalar(AsepriteReader::BlendMode mode, uint8_t *dst, const uint8_t *src, int count, int opacity);
+
+// Row kernel picked for this CPU: "avx2", "sse2" or "scalar"
+const char *blendRowKernel();
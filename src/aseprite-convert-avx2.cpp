@@ -0,0 +1,30 @@
+/*
+ * aseprite-convert-avx2.cpp
+ *
+ *  AVX2 palette lookup, 8 pixels per gather. Built with AVX2 enabled (see
+ *  binding.gyp) and only called after a CPU check.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+// Returns the number of pixels expanded, the caller finishes the row
+size_t indexedToRGBAAVX2(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t *lut)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+		const __m256i color = _mm256_i32gather_epi32((const int *)lut, index, 4);
+		_mm256_storeu_si256((__m256i *)(dst + i * 4), color);
+	}
+
+	return i;
+}
+
+#endif
@@ -0,0 +1,478 @@
+/*
+ * aseprite-convert.cpp
+ *
+ *  Indexed pixels go through a packed 256 entry table, one 32 bit store per
+ *  pixel (gathered 8 at a time with AVX2). Grayscale pixels are widened
+ *  with SSE2 unpacks, 8 per step.
+ *
+ *  Output formats are converted by a template per color depth and format:
+ *  indexed pixels through a table holding the output pixels, RGBA to BGRA
+ *  and premultiplied RGBA with SSE2, 4 pixels per step, and the rest with
+ *  loops simple enough for the compiler to vectorize.
+ */
+
+#include "aseprite-convert.h"
+#include "aseprite-blend.h"
+#include "cpu-features.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef ASEPRITE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(ASEPRITE_X86) && defined(ASEPRITE_AVX2)
+size_t indexedToRGBAAVX2(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t *lut);
+
+static const bool useAVX2 = cpuHasAVX2();
+#endif
+
+void buildPaletteLUT(const AsepriteReader::AsepriteFile &file, bool background, uint32_t lut[256])
+{
+	const size_t numColors = file.palette ? file.palette->colors.size() : 0;
+	const int transparent = background ? -1 : file.transparentIndex;
+
+	for (int i = 0; i < 256; i++)
+	{
+		uint8_t rgba[4] = {0, 0, 0, 0};
+
+		if (i != transparent && (size_t)i < numColors)
+		{
+			const auto &color = file.palette->colors[i];
+			rgba[0] = color.r;
+			rgba[1] = color.g;
+			rgba[2] = color.b;
+			rgba[3] = color.a;
+		}
+
+		// Kept in memory order, whatever the endianness
+		memcpy(&lut[i], rgba, 4);
+	}
+}
+
+void indexedToRGBA(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t lut[256])
+{
+	size_t i = 0;
+
+#if defined(ASEPRITE_X86) && defined(ASEPRITE_AVX2)
+	if (useAVX2)
+		i = indexedToRGBAAVX2(dst, src, count, lut);
+#endif
+
+	for (; i < count; i++)
+		memcpy(dst + i * 4, &lut[src[i]], 4);
+}
+
+void grayscaleToRGBA(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i = 0;
+
+#ifdef ASEPRITE_SSE2
+	// Each 16 bit lane holds value | alpha << 8, so pairing (value | value << 8)
+	// with the lane itself gives value, value, value, alpha
+	const __m128i low = _mm_set1_epi16(0x00ff);
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m128i pixels = _mm_loadu_si128((const __m128i *)(src + i * 2));
+		const __m128i value = _mm_and_si128(pixels, low);
+		const __m128i doubled = _mm_or_si128(value, _mm_slli_epi16(value, 8));
+
+		_mm_storeu_si128((__m128i *)(dst + i * 4), _mm_unpacklo_epi16(doubled, pixels));
+		_mm_storeu_si128((__m128i *)(dst + i * 4 + 16), _mm_unpackhi_epi16(doubled, pixels));
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		dst[i * 4] = dst[i * 4 + 1] = dst[i * 4 + 2] = src[i * 2];
+		dst[i * 4 + 3] = src[i * 2 + 1];
+	}
+}
+
+void convertToRGBA(int colorDepth, uint8_t *dst, const uint8_t *src, size_t count, const uint32_t lut[256])
+{
+	if (colorDepth == 8)
+		indexedToRGBA(dst, src, count, lut);
+	else if (colorDepth == 16)
+		grayscaleToRGBA(dst, src, count);
+	else
+		memcpy(dst, src, count * 4);
+}
+
+void tileRowToRGBA(int colorDepth, uint8_t *dst, const AsepriteReader::Tileset &tileset, uint32_t tile, int y, const uint32_t lut[256])
+{
+	typedef AsepriteReader R;
+	const int w = tileset.tileWidth;
+	const int h = tileset.tileHeight;
+	const uint32_t index = tile & R::TILE_INDEX_MASK;
+	const size_t bytesPerPixel = colorDepth / 8;
+
+	if (!tileset.pixels || index >= tileset.numTiles)
+	{
+		memset(dst, 0, (size_t)w * 4);
+		return;
+	}
+
+	const uint8_t *image = tileset.pixels.get() + (size_t)index * w * h * bytesPerPixel;
+	const int sy = (tile & R::TILE_FLIP_Y) ? h - 1 - y : y;
+
+	if (!(tile & R::TILE_FLIP_D) || w != h)
+	{
+		convertToRGBA(colorDepth, dst, image + (size_t)sy * w * bytesPerPixel, w, lut);
+
+		if (tile & R::TILE_FLIP_X)
+		{
+			uint32_t *pixels = reinterpret_cast<uint32_t *>(dst);
+			std::reverse(pixels, pixels + w);
+		}
+		return;
+	}
+
+	// Diagonal flip: the row comes from column `sy` of the tile
+	for (int x = 0; x < w; x++)
+	{
+		const int sx = (tile & R::TILE_FLIP_X) ? w - 1 - x : x;
+		convertToRGBA(colorDepth, dst + x * 4, image + ((size_t)sx * w + sy) * bytesPerPixel, 1, lut);
+	}
+}
+
+std::shared_ptr<uint8_t> AsepriteReader::toRGBA(Cel *cel, size_t *length)
+{
+	std::shared_ptr<uint8_t> pixels = cel->getPixels();
+	const Tileset *tileset = cel->layer ? cel->layer->tileset : nullptr;
+
+	if (file.pixelFormat != PixelFormat::NATIVE && file.pixelFormat != PixelFormat::RGBA8)
+		throw ResourceLoadException("Cels can only be expanded from native or RGBA pixels");
+
+	if (length)
+		*length = 0;
+	if (!pixels || (cel->tilemap && !tileset))
+		return nullptr;
+
+	if (!cel->tilemap && file.colorDepth == 32)
+	{
+		if (length)
+			*length = cel->pixelsLength;
+		return pixels;
+	}
+
+	const bool background = cel->layer && (cel->layer->flags & LAYER_FLAG_BACKGROUND);
+	uint32_t lut[256];
+	if (file.colorDepth == 8)
+		buildPaletteLUT(file, background, lut);
+
+	const int tileW = cel->tilemap ? tileset->tileWidth : 1;
+	const int tileH = cel->tilemap ? tileset->tileHeight : 1;
+	const size_t rgbaLength = (size_t)cel->w * tileW * cel->h * tileH * 4;
+	std::shared_ptr<uint8_t> rgba(new uint8_t[std::max<size_t>(rgbaLength, 1)], std::default_delete<uint8_t[]>());
+
+	if (!cel->tilemap)
+	{
+		convertToRGBA(file.colorDepth, rgba.get(), pixels.get(), (size_t)cel->w * cel->h, lut);
+	}
+	else
+	{
+		const uint32_t *tiles = reinterpret_cast<const uint32_t *>(pixels.get());
+		const size_t stride = (size_t)cel->w * tileW * 4;
+
+		for (int ty = 0; ty < cel->h; ty++)
+		{
+			for (int tx = 0; tx < cel->w; tx++)
+			{
+				uint8_t *dst = rgba.get() + (size_t)ty * tileH * stride + (size_t)tx * tileW * 4;
+				for (int y = 0; y < tileH; y++)
+					tileRowToRGBA(file.colorDepth, dst + y * stride, *tileset, tiles[(size_t)ty * cel->w + tx], y, lut);
+			}
+		}
+	}
+
+	if (length)
+		*length = rgbaLength;
+	return rgba;
+}
+
+typedef AsepriteReader::PixelFormat PixelFormat;
+
+// Source pixels, loaded as R, G, B, A
+template <int Depth>
+struct SourcePixel;
+
+template <>
+struct SourcePixel<32>
+{
+	static void load(const uint8_t *src, int &r, int &g, int &b, int &a)
+	{
+		r = src[0];
+		g = src[1];
+		b = src[2];
+		a = src[3];
+	}
+};
+
+template <>
+struct SourcePixel<16>
+{
+	static void load(const uint8_t *src, int &r, int &g, int &b, int &a)
+	{
+		r = g = b = src[0];
+		a = src[1];
+	}
+};
+
+// Output pixels, stored from R, G, B, A
+template <PixelFormat Format>
+struct TargetPixel;
+
+template <>
+struct TargetPixel<PixelFormat::RGBA8>
+{
+	static const size_t BYTES = 4;
+	static void store(uint8_t *dst, int r, int g, int b, int a)
+	{
+		dst[0] = r;
+		dst[1] = g;
+		dst[2] = b;
+		dst[3] = a;
+	}
+};
+
+template <>
+struct TargetPixel<PixelFormat::BGRA8>
+{
+	static const size_t BYTES = 4;
+	static void store(uint8_t *dst, int r, int g, int b, int a)
+	{
+		dst[0] = b;
+		dst[1] = g;
+		dst[2] = r;
+		dst[3] = a;
+	}
+};
+
+template <>
+struct TargetPixel<PixelFormat::RGBA8_PREMULTIPLIED>
+{
+	static const size_t BYTES = 4;
+	static void store(uint8_t *dst, int r, int g, int b, int a)
+	{
+		dst[0] = mulUn8(r, a);
+		dst[1] = mulUn8(g, a);
+		dst[2] = mulUn8(b, a);
+		dst[3] = a;
+	}
+};
+
+template <>
+struct TargetPixel<PixelFormat::RGB565>
+{
+	static const size_t BYTES = 2;
+	static void store(uint8_t *dst, int r, int g, int b, int)
+	{
+		const uint16_t value = (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+		memcpy(dst, &value, 2);
+	}
+};
+
+template <>
+struct TargetPixel<PixelFormat::RGBA4444>
+{
+	static const size_t BYTES = 2;
+	static void store(uint8_t *dst, int r, int g, int b, int a)
+	{
+		const uint16_t value = (uint16_t)(((r >> 4) << 12) | ((g >> 4) << 8) | ((b >> 4) << 4) | (a >> 4));
+		memcpy(dst, &value, 2);
+	}
+};
+
+// Pixels `from` to `count`, one at a time
+template <int Depth, PixelFormat Format>
+static void convertPixels(uint8_t *dst, const uint8_t *src, size_t from, size_t count)
+{
+	typedef TargetPixel<Format> Target;
+
+	for (size_t i = from; i < count; i++)
+	{
+		int r, g, b, a;
+		SourcePixel<Depth>::load(src + i * (Depth / 8), r, g, b, a);
+		Target::store(dst + i * Target::BYTES, r, g, b, a);
+	}
+}
+
+template <int Depth, PixelFormat Format>
+struct Converter
+{
+	static void run(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t *)
+	{
+		convertPixels<Depth, Format>(dst, src, 0, count);
+	}
+};
+
+// Indexed pixels: the table holds output pixels already
+template <PixelFormat Format>
+struct Converter<8, Format>
+{
+	static void run(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t *lut)
+	{
+		if constexpr (TargetPixel<Format>::BYTES == 4)
+		{
+			indexedToRGBA(dst, src, count, lut);
+		}
+		else
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				const uint16_t value = (uint16_t)lut[src[i]];
+				memcpy(dst + i * 2, &value, 2);
+			}
+		}
+	}
+};
+
+// Gray is the same in RGBA and BGRA
+template <>
+struct Converter<16, PixelFormat::RGBA8>
+{
+	static void run(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t *)
+	{
+		grayscaleToRGBA(dst, src, count);
+	}
+};
+
+template <>
+struct Converter<16, PixelFormat::BGRA8>
+{
+	static void run(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t *)
+	{
+		grayscaleToRGBA(dst, src, count);
+	}
+};
+
+template <>
+struct Converter<32, PixelFormat::RGBA8>
+{
+	static void run(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t *)
+	{
+		memcpy(dst, src, count * 4);
+	}
+};
+
+template <>
+struct Converter<32, PixelFormat::BGRA8>
+{
+	static void run(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t *)
+	{
+		size_t i = 0;
+
+#ifdef ASEPRITE_SSE2
+		// Swaps the bytes of R and B within each 32 bit lane
+		const __m128i keep = _mm_set1_epi32((int)0xff00ff00);
+		const __m128i low = _mm_set1_epi32(0xff);
+
+		for (; i + 4 <= count; i += 4)
+		{
+			const __m128i pixels = _mm_loadu_si128((const __m128i *)(src + i * 4));
+			const __m128i r = _mm_slli_epi32(_mm_and_si128(pixels, low), 16);
+			const __m128i b = _mm_and_si128(_mm_srli_epi32(pixels, 16), low);
+			_mm_storeu_si128((__m128i *)(dst + i * 4), _mm_or_si128(_mm_and_si128(pixels, keep), _mm_or_si128(r, b)));
+		}
+#endif
+
+		convertPixels<32, PixelFormat::BGRA8>(dst, src, i, count);
+	}
+};
+
+template <>
+struct Converter<32, PixelFormat::RGBA8_PREMULTIPLIED>
+{
+	static void run(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t *)
+	{
+		size_t i = 0;
+
+#ifdef ASEPRITE_SSE2
+		// Channels widened to 16 bits, multiplied by their pixel's alpha and
+		// divided by 255 as div255 does. Alpha itself is put back as is.
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i half = _mm_set1_epi16(0x80);
+		const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+
+		auto premultiply = [half](__m128i channels)
+		{
+			const __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(channels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			const __m128i x = _mm_add_epi16(_mm_mullo_epi16(channels, a), half);
+			return _mm_srli_epi16(_mm_add_epi16(_mm_srli_epi16(x, 8), x), 8);
+		};
+
+		for (; i + 4 <= count; i += 4)
+		{
+			const __m128i pixels = _mm_loadu_si128((const __m128i *)(src + i * 4));
+			const __m128i lo = premultiply(_mm_unpacklo_epi8(pixels, zero));
+			const __m128i hi = premultiply(_mm_unpackhi_epi8(pixels, zero));
+			const __m128i colors = _mm_andnot_si128(alpha, _mm_packus_epi16(lo, hi));
+			_mm_storeu_si128((__m128i *)(dst + i * 4), _mm_or_si128(colors, _mm_and_si128(pixels, alpha)));
+		}
+#endif
+
+		convertPixels<32, PixelFormat::RGBA8_PREMULTIPLIED>(dst, src, i, count);
+	}
+};
+
+template <int Depth>
+static PixelConverter converterFor(PixelFormat format)
+{
+	switch (format)
+	{
+	case PixelFormat::RGBA8: return &Converter<Depth, PixelFormat::RGBA8>::run;
+	case PixelFormat::BGRA8: return &Converter<Depth, PixelFormat::BGRA8>::run;
+	case PixelFormat::RGBA8_PREMULTIPLIED: return &Converter<Depth, PixelFormat::RGBA8_PREMULTIPLIED>::run;
+	case PixelFormat::RGB565: return &Converter<Depth, PixelFormat::RGB565>::run;
+	case PixelFormat::RGBA4444: return &Converter<Depth, PixelFormat::RGBA4444>::run;
+	default: return nullptr;
+	}
+}
+
+PixelConverter pixelConverter(int colorDepth, PixelFormat format)
+{
+	switch (colorDepth)
+	{
+	case 8: return converterFor<8>(format);
+	case 16: return converterFor<16>(format);
+	case 32: return converterFor<32>(format);
+	default: return nullptr;
+	}
+}
+
+void buildFormatLUT(const AsepriteReader::AsepriteFile &file, bool background, PixelFormat format, uint32_t lut[256])
+{
+	uint32_t rgba[256];
+	buildPaletteLUT(file, background, rgba);
+
+	uint8_t converted[256 * 4];
+	pixelConverter(32, format)(converted, reinterpret_cast<const uint8_t *>(rgba), 256, nullptr);
+
+	for (int i = 0; i < 256; i++)
+	{
+		if (pixelFormatBytes(format, 32) == 4)
+		{
+			memcpy(&lut[i], converted + i * 4, 4);
+		}
+		else
+		{
+			uint16_t value;
+			memcpy(&value, converted + i * 2, 2);
+			lut[i] = value;
+		}
+	}
+}
+
+size_t pixelFormatBytes(PixelFormat format, int colorDepth)
+{
+	switch (format)
+	{
+	case PixelFormat::NATIVE: return colorDepth / 8;
+	case PixelFormat::RGB565:
+	case PixelFormat::RGBA4444: return 2;
+	default: return 4;
+	}
+}
@@ -0,0 +1,49 @@
+/*
+ * aseprite-convert.h
+ *
+ *  Expansion of indexed and grayscale pixels to RGBA8 (R first in memory),
+ *  used by the renderer, AsepriteReader::toRGBA and drawing of single
+ *  tiles, and conversion to the output formats of the `format` and `rgba`
+ *  load options.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "aseprite-reader.h"
+
+// Packs the palette into `lut`, one RGBA color per index. Indexes past the
+// palette are transparent, and so is the file's transparent index unless
+// the pixels belong to a background layer.
+void buildPaletteLUT(const AsepriteReader::AsepriteFile &file, bool background, uint32_t lut[256]);
+
+// Expands `count` indexed pixels through a table from buildPaletteLUT
+void indexedToRGBA(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t lut[256]);
+
+// Expands `count` grayscale + alpha pixels
+void grayscaleToRGBA(uint8_t *dst, const uint8_t *src, size_t count);
+
+// Expands `count` pixels of the given color depth (8 or 16), copies 32 bit
+// ones. `lut` is only read for indexed pixels.
+void convertToRGBA(int colorDepth, uint8_t *dst, const uint8_t *src, size_t count, const uint32_t lut[256]);
+
+// Expands row `y` of `tile` (index and flips, see TILE_INDEX_MASK) to
+// tileset.tileWidth RGBA pixels. Tiles missing from the tileset come out
+// transparent. The diagonal flip only applies to square tiles.
+void tileRowToRGBA(int colorDepth, uint8_t *dst, const AsepriteReader::Tileset &tileset, uint32_t tile, int y, const uint32_t lut[256]);
+
+// Converts `count` pixels of a color depth (8, 16 or 32) to an output
+// format. Indexed pixels go through a table from buildFormatLUT.
+typedef void (*PixelConverter)(uint8_t *dst, const uint8_t *src, size_t count, const uint32_t lut[256]);
+
+// The converter of a color depth and format pair, each pair a template
+// instance of its own. Null for NATIVE and unknown depths.
+PixelConverter pixelConverter(int colorDepth, AsepriteReader::PixelFormat format);
+
+// buildPaletteLUT with the colors converted to `format`, 16 bit formats in
+// the low half of each entry
+void buildFormatLUT(const AsepriteReader::AsepriteFile &file, bool background, AsepriteReader::PixelFormat format, uint32_t lut[256]);
+
+// Bytes per pixel of `format`, NATIVE meaning those of `colorDepth`
+size_t pixelFormatBytes(AsepriteReader::PixelFormat format, int colorDepth);
@@ -6,9 +6,24 @@
  */
 
 #include "aseprite-reader.h"
-
+#include "aseprite-convert.h"
+#include "byte-reader.h"
+#include "mapped-file.h"
+#include "parallel.h"
+#include "xxhash64.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <climits>
 #include <map>
+#include <unordered_map>
+
+#ifdef ASEPRITE_USE_LIBDEFLATE
+#include <libdeflate.h>
+#else
 #include <zlib.h>
+#endif
 
 #ifdef IS_NODE
 
@@ -18,12 +33,15 @@ using namespace Napi;
 
 #define n_num(val) Number::New(env, val)
 #define n_str(val) String::New(env, val)
-#define newArray Array::New(env)
-#define newObject Object::New(env)
+// JS objects are only counted for loads with stats
+#define countObjects(count) (options.stats ? (void)(stats.jsObjects += (count)) : (void)0)
+#define newArray (countObjects(1), Array::New(env))
+#define newObject (countObjects(1), Object::New(env))
 
 #define obj_push(obj, val) obj[obj.Length()] = val
 #define set_color(key, val)              \
 	Array objColor = Array::New(env, 4); \
+	countObjects(1);                     \
 	objColor[0u] = n_num(val.r);         \
 	objColor[1u] = n_num(val.g);         \
 	objColor[2u] = n_num(val.b);         \
@@ -34,6 +52,7 @@ using namespace Napi;
 
 const uint16_t ASEPRITE_MAGIC_NUMBER_FILE = 0xA5E0;
 const uint16_t ASEPRITE_MAGIC_NUMBER_FRAME = 0xF1FA;
+const uint32_t ASEPRITE_HEADER_SIZE = 128;
 
 enum ChunkType
 {
@@ -44,12 +63,50 @@ enum ChunkType
 	CHUNK_PALETTE = 0x2019,
 	CHUNK_USERDATA = 0x2020,
 	CHUNK_SLICE = 0x2022,
+	CHUNK_TILESET = 0x2023,
 };
 
+const char *AsepriteReader::LoadStats::chunkName(uint16_t type)
+{
+	switch (type)
+	{
+	case 0x0004: return "oldPalette";
+	case 0x0011: return "oldPalette2";
+	case CHUNK_LAYER: return "layer";
+	case CHUNK_CEL: return "cel";
+	case CHUNK_CELEXTRA: return "celExtra";
+	case 0x2007: return "colorProfile";
+	case 0x2008: return "externalFiles";
+	case 0x2016: return "mask";
+	case 0x2017: return "path";
+	case CHUNK_FRAME_TAGS: return "tags";
+	case CHUNK_PALETTE: return "palette";
+	case CHUNK_USERDATA: return "userData";
+	case CHUNK_SLICE: return "slice";
+	case CHUNK_TILESET: return "tileset";
+	default: return nullptr;
+	}
+}
+
+const char *AsepriteReader::pixelFormatName(PixelFormat format)
+{
+	switch (format)
+	{
+	case PixelFormat::NATIVE: return "native";
+	case PixelFormat::RGBA8: return "rgba";
+	case PixelFormat::BGRA8: return "bgra";
+	case PixelFormat::RGBA8_PREMULTIPLIED: return "rgba-premultiplied";
+	case PixelFormat::RGB565: return "rgb565";
+	case PixelFormat::RGBA4444: return "rgba4444";
+	default: return nullptr;
+	}
+}
+
 enum LayerType
 {
 	LAYER_NORMAL = 0,
 	LAYER_GROUP = 1,
+	LAYER_TILEMAP = 2,
 };
 
 enum Flag
@@ -59,6 +116,12 @@ enum Flag
 
 	FLAG_SLICE_9SLICES = 0x1 << 0,
 	FLAG_SLICE_PIVOT = 0x1 << 1,
+
+	FLAG_TILESET_EXTERNAL = 0x1 << 0,
+	FLAG_TILESET_TILES = 0x1 << 1,
+
+	FLAG_FILE_LAYER_OPACITY = 0x1 << 0,
+	FLAG_FILE_GROUP_BLENDING = 0x1 << 1,
 };
 
 enum CelType
@@ -66,508 +129,1974 @@ enum CelType
 	CEL_RAW = 0,
 	CEL_LINKED = 1,
 	CEL_COMPRESSED = 2,
+	CEL_COMPRESSED_TILEMAP = 3,
 };
 
-#ifdef IS_NODE
-void AsepriteReader::load(const uint8_t *in, const uint32_t size, const CallbackInfo &info)
-#else
-void AsepriteReader::load(const uint8_t *in, const uint32_t size)
-#endif
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start)
 {
-	uint32_t ptr = 0;
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
 
-	auto readUInt8 = [&ptr, &size](const uint8_t *in) -> uint8_t
-	{
-		uint8_t tmp = in[ptr];
-		ptr++;
-		if (ptr > size)
-			throw ResourceLoadException("Unexpected EOF");
-		return tmp;
-	};
-	auto readInt16 = [&ptr, &size](const uint8_t *in) -> int16_t
-	{
-		int16_t tmp = in[ptr] | (in[ptr + 1] << 8);
-		ptr += 2;
-		if (ptr > size)
-			throw ResourceLoadException("Unexpected EOF");
-		return tmp;
-	};
-	auto readUInt16 = [&ptr, &size](const uint8_t *in) -> uint16_t
-	{
-		uint16_t tmp = in[ptr] | (in[ptr + 1] << 8);
-		ptr += 2;
-		if (ptr > size)
-			throw ResourceLoadException("Unexpected EOF");
-		return tmp;
-	};
-	auto readUInt32 = [&ptr, &size](const uint8_t *in) -> uint32_t
+// Counts and times one chunk into `stats` over its lifetime. Empty without
+// stats, so that such loads carry no measuring code at all.
+template <bool Stats>
+struct ChunkTimer
+{
+	ChunkTimer(AsepriteReader::LoadStats &, uint16_t, uint32_t) {}
+};
+
+template <>
+struct ChunkTimer<true>
+{
+	AsepriteReader::ChunkStats &stat;
+	Clock::time_point start;
+
+	ChunkTimer(AsepriteReader::LoadStats &stats, uint16_t type, uint32_t size) : stat(stats.chunks[type]), start(Clock::now())
 	{
-		uint32_t tmp = in[ptr] | (in[ptr + 1] << 8) | (in[ptr + 2] << 16) | (in[ptr + 3] << 24);
-		ptr += 4;
-		if (ptr > size)
-			throw ResourceLoadException("Unexpected EOF");
-		return tmp;
-	};
-	auto readString = [&ptr, &size](const uint8_t *in, unsigned short length) -> std::string
+		stat.count++;
+		stat.bytes += size;
+	}
+	~ChunkTimer() { stat.seconds += secondsSince(start); }
+};
+
+// Cel pixels are shared between linked cels and with JS, so they are kept in
+// a shared_ptr that has to know it owns an array
+static std::shared_ptr<uint8_t> allocPixels(size_t length)
+{
+	return std::shared_ptr<uint8_t>(new uint8_t[length], std::default_delete<uint8_t[]>());
+}
+
+// Cel offsets in a shared pixel block are kept 16 bytes aligned
+static size_t alignPixels(size_t length)
+{
+	return (length + 15) & ~(size_t)15;
+}
+
+// Items equal to an earlier one, with the index of that one. Hashes pick
+// the candidates, `equal` compares them.
+template <typename Equal>
+static std::vector<std::pair<size_t, size_t>> findDuplicates(const std::vector<uint64_t> &hashes, Equal equal)
+{
+	std::vector<std::pair<size_t, size_t>> duplicates;
+	std::unordered_multimap<uint64_t, size_t> originals;
+	originals.reserve(hashes.size());
+
+	for (size_t i = 0; i < hashes.size(); i++)
 	{
-		std::string buff;
-		buff.resize(length); // Resize adds \0 at the end
-		for (unsigned short i = 0; i < length; i++, ptr++)
+		bool found = false;
+		auto range = originals.equal_range(hashes[i]);
+		for (auto it = range.first; it != range.second && !found; ++it)
 		{
-			buff[i] = in[ptr];
+			if (equal(it->second, i))
+			{
+				duplicates.push_back({i, it->second});
+				found = true;
+			}
 		}
-		if (ptr > size)
-			throw ResourceLoadException("Unexpected EOF");
-		return buff;
+		if (!found)
+			originals.emplace(hashes[i], i);
+	}
+	return duplicates;
+}
+
+// Raw cel data may be shorter than the cel, the rest is left transparent
+static void copyRawPixels(uint8_t *pixels, size_t length, const uint8_t *data, uint32_t dataLength)
+{
+	const size_t copyLength = std::min<size_t>(dataLength, length);
+	memcpy(pixels, data, copyLength);
+	memset(pixels + copyLength, 0, length - copyLength);
+}
+
+// Inflates cel data straight from the input into the pixels. Each thread
+// keeps its decompressor, instead of setting one up for every cel.
+#ifdef ASEPRITE_USE_LIBDEFLATE
+static bool inflatePixels(uint8_t *pixels, size_t length, const uint8_t *data, uint32_t dataLength)
+{
+	struct Decompressor
+	{
+		libdeflate_decompressor *decompressor = libdeflate_alloc_decompressor();
+		~Decompressor() { libdeflate_free_decompressor(decompressor); }
 	};
-	auto readBytes = [&ptr, &size](const uint8_t *in, unsigned short length) -> uint8_t *
+	thread_local Decompressor local;
+
+	// Like uncompress, data shorter than the cel is not an error
+	size_t inflated;
+	return local.decompressor && libdeflate_zlib_decompress(local.decompressor, data, dataLength, pixels, length, &inflated) == LIBDEFLATE_SUCCESS;
+}
+#else
+static bool inflatePixels(uint8_t *pixels, size_t length, const uint8_t *data, uint32_t dataLength)
+{
+	struct Inflater
 	{
-		uint8_t *data = new uint8_t[length + 1];
-		for (unsigned short i = 0; i < length; i++, ptr++)
+		z_stream stream = {};
+		bool ready = inflateInit(&stream) == Z_OK;
+		~Inflater()
 		{
-			data[i] = in[ptr];
+			if (ready)
+				inflateEnd(&stream);
 		}
-		data[length] = 0;
-		if (ptr > size)
-			throw ResourceLoadException("Unexpected EOF");
-		return data;
-	};
-	auto skipBytes = [&ptr, &size](const uint8_t *in, int count) -> void
-	{
-		ptr += count;
-		if (ptr > size)
-			throw ResourceLoadException("Unexpected EOF");
 	};
+	thread_local Inflater local;
 
-#ifdef IS_NODE
-	Env env = info.Env();
-	object = newObject;
+	if (!local.ready || length > UINT_MAX || inflateReset(&local.stream) != Z_OK)
+		return false;
+
+	local.stream.next_in = const_cast<Bytef *>(data);
+	local.stream.avail_in = dataLength;
+	local.stream.next_out = pixels;
+	local.stream.avail_out = (uInt)length;
+
+	return inflate(&local.stream, Z_FINISH) == Z_STREAM_END;
+}
 #endif
 
-	skipBytes(in, 4); // File size
+// Rewrites tiles read from the file (little endian, in the cel's bit layout)
+// as native TILE_* values, in place
+static void normalizeTiles(uint8_t *tiles, size_t count, const uint32_t masks[4])
+{
+	typedef AsepriteReader R;
+	const uint32_t flips[3] = {R::TILE_FLIP_X, R::TILE_FLIP_Y, R::TILE_FLIP_D};
+
+	int shift = 0;
+	while (masks[0] && !((masks[0] >> shift) & 1))
+		shift++;
 
-	if (readUInt16(in) != ASEPRITE_MAGIC_NUMBER_FILE)
+	for (size_t i = 0; i < count; i++, tiles += 4)
 	{
-		throw ResourceLoadException("Magic number mismatch");
+		const uint32_t stored = tiles[0] | (tiles[1] << 8) | (tiles[2] << 16) | ((uint32_t)tiles[3] << 24);
+		uint32_t tile = ((stored & masks[0]) >> shift) & R::TILE_INDEX_MASK;
+
+		for (int f = 0; f < 3; f++)
+		{
+			if (stored & masks[f + 1])
+				tile |= flips[f];
+		}
+		memcpy(tiles, &tile, 4);
 	}
+}
 
-	const unsigned short FRAME_COUNT = readUInt16(in);
-	file.width = readUInt16(in);
-	file.height = readUInt16(in);
-	file.numFrames = FRAME_COUNT;
-	file.colorDepth = readUInt16(in);
-	const unsigned short bytesPerPixel = file.colorDepth / 8;
-	file.palette = std::make_unique<Palette>();
+std::shared_ptr<uint8_t> AsepriteReader::Cel::getPixels()
+{
+	if (pixels)
+		return pixels;
 
-	skipBytes(in, 4 + 2 + 12); // File flags + Deprecated speed
+	if (linkedCel)
+	{
+		pixels = linkedCel->getPixels();
+	}
+	else if (source)
+	{
+		std::shared_ptr<uint8_t> data = allocPixels(pixelsLength);
 
-	file.numColors = readUInt16(in);
-	uint8_t pixelWidth = readUInt8(in);
-	uint8_t pixelHeight = readUInt8(in);
-	file.pixelRatio = pixelWidth && pixelHeight ? (double)pixelWidth / (double)pixelHeight : 1.0;
+		if (!sourceCompressed)
+			copyRawPixels(data.get(), pixelsLength, source, sourceLength);
+		else if (!inflatePixels(data.get(), pixelsLength, source, sourceLength))
+			throw ResourceLoadException("Data decompression failed");
 
-	skipBytes(in, 92);
+		if (tilemap)
+			normalizeTiles(data.get(), pixelsLength / 4, tileMasks);
+		pixels = data;
+	}
 
-#ifdef IS_NODE
-	// general node object
-	object["width"] = n_num(file.width);
-	object["height"] = n_num(file.height);
-	object["colorDepth"] = n_num(file.colorDepth);
-	object["numFrames"] = n_num(FRAME_COUNT);
-	object["numColors"] = n_num(file.numColors);
-	object["pixelRatio"] = n_num(file.pixelRatio);
+	return pixels;
+}
 
-	// node object arrays and objects
-	Array objFrames = newArray;
-	Array objTags = newArray;
-	Array objLayers = newArray;
-	Array objCels = newArray;
-	Array objSlices = newArray;
-	Object objPalette = newObject;
-	object["frames"] = objFrames;
-	object["tags"] = objTags;
-	object["layers"] = objLayers;
-	object["cels"] = objCels;
-	object["slices"] = objSlices;
-	object["palette"] = objPalette;
-#endif
+void AsepriteReader::Cel::releasePixels()
+{
+	if (linkedCel || source)
+		pixels.reset();
+}
 
-	uint16_t layerIndex = 0;
-	std::map<int, Layer *> layerLevelMap;
+void AsepriteReader::load(const uint8_t *in, const uint32_t size)
+{
+	read(in, size, false);
+}
 
-	for (unsigned idxFrame = 0u; idxFrame < FRAME_COUNT; ++idxFrame)
-	{
-		skipBytes(in, 4);
+void AsepriteReader::loadMetadata(const uint8_t *in, const uint32_t size)
+{
+	read(in, size, true);
+}
 
-		if (readUInt16(in) != ASEPRITE_MAGIC_NUMBER_FRAME)
-		{
-			throw ResourceLoadException("Magic number mismatch");
-		}
+std::shared_ptr<MappedFile> AsepriteReader::mapFile(const std::string &path)
+{
+	std::shared_ptr<MappedFile> mapped = std::make_shared<MappedFile>();
 
-		file.frames.push_back(std::make_unique<Frame>());
-		Frame *frame = file.frames.back().get();
+	if (!mapped->open(path))
+		throw ResourceLoadException(mapped->error());
+	if (mapped->size() > UINT32_MAX)
+		throw ResourceLoadException("File too large: " + path);
+	return mapped;
+}
 
-		const unsigned short CHUNK_COUNT = readUInt16(in);
-		frame->duration = readUInt16(in);
-		skipBytes(in, 6);
+void AsepriteReader::loadFile(const std::string &path)
+{
+	std::shared_ptr<MappedFile> mapped = mapFile(path);
 
-#ifdef IS_NODE
-		// frame node object
-		frame->object = newObject;
-		frame->objCels = newArray;
-		frame->objTags = newArray;
-		obj_push(objFrames, frame->object);
-		frame->object["duration"] = n_num(frame->duration);
-		frame->object["cels"] = frame->objCels;
-		frame->object["tags"] = frame->objTags;
-#endif
+	load(mapped->data(), (uint32_t)mapped->size());
 
-		for (unsigned idxChunk = 0u; idxChunk < CHUNK_COUNT; ++idxChunk)
-		{
-			const unsigned int CHUNK_SIZE = readUInt32(in);
-			const unsigned short CHUNK_TYPE = readUInt16(in);
+	// Lazy cels read from the mapping later on
+	mapping = options.lazy ? mapped : nullptr;
+}
 
-			switch (CHUNK_TYPE)
-			{
-			case CHUNK_LAYER:
-			{
-				file.layers.push_back(std::make_unique<Layer>());
-				Layer *layer = file.layers.back().get();
+static void putUInt32(std::vector<uint8_t> &out, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		out.push_back((value >> (i * 8)) & 0xff);
+}
 
-				const unsigned short LAYER_FLAGS = readUInt16(in);
-				const unsigned short LAYER_TYPE = readUInt16(in);
+static const uint8_t FRAME_INDEX_MAGIC[4] = {'A', 'F', 'I', 'X'};
+static const uint32_t FRAME_INDEX_VERSION = 1;
+static const uint32_t FRAME_INDEX_HEADER_SIZE = 16;
+static const uint32_t FRAME_INDEX_ENTRY_SIZE = 14;
 
-				layer->index = layerIndex;
-				layer->flags = LAYER_FLAGS;
-				layer->type = LAYER_TYPE;
+std::vector<uint8_t> AsepriteReader::FrameIndex::serialize() const
+{
+	std::vector<uint8_t> out(FRAME_INDEX_MAGIC, FRAME_INDEX_MAGIC + 4);
+	out.reserve(FRAME_INDEX_HEADER_SIZE + frames.size() * FRAME_INDEX_ENTRY_SIZE);
+	putUInt32(out, FRAME_INDEX_VERSION);
+	putUInt32(out, fileSize);
+	putUInt32(out, (uint32_t)frames.size());
 
-				const unsigned short LAYER_CHILD_LEVEL = readUInt16(in);
-				skipBytes(in, 4);
+	for (const Entry &entry : frames)
+	{
+		putUInt32(out, entry.offset);
+		putUInt32(out, entry.size);
+		putUInt32(out, entry.chunkCount);
+		out.push_back(entry.duration & 0xff);
+		out.push_back(entry.duration >> 8);
+	}
+	return out;
+}
 
-				layer->blendMode = static_cast<BlendMode>(readUInt16(in));
-				layer->opacity = readUInt32(in);
-				layer->name = readString(in, readUInt16(in));
+AsepriteReader::FrameIndex AsepriteReader::FrameIndex::deserialize(const uint8_t *data, size_t size)
+{
+	if (size < FRAME_INDEX_HEADER_SIZE || memcmp(data, FRAME_INDEX_MAGIC, 4) != 0)
+		throw ResourceLoadException("Not a frame index");
+
+	ByteReader reader(data, size);
+	reader.skip(4);
+	if (reader.u32() != FRAME_INDEX_VERSION)
+		throw ResourceLoadException("Unsupported frame index version");
+
+	FrameIndex index;
+	index.fileSize = reader.u32();
+	const uint32_t count = reader.u32();
+	if (count > reader.remaining() / FRAME_INDEX_ENTRY_SIZE)
+		throw ResourceLoadException("Truncated frame index");
+
+	// The count check covers every entry
+	index.frames.resize(count);
+	for (Entry &entry : index.frames)
+	{
+		entry.offset = reader.u32();
+		entry.size = reader.u32();
+		entry.chunkCount = reader.u32();
+		entry.duration = reader.u16();
+	}
+	return index;
+}
 
-#ifdef IS_NODE
-				// layer node object
-				layer->object = newObject;
-				layer->objChildren = newArray;
-				obj_push(objLayers, layer->object);
-				layer->object["name"] = n_str(layer->name);
-				layer->object["index"] = n_num(layer->index);
-				layer->object["type"] = n_num(layer->type);
-				layer->object["flags"] = n_num(layer->flags);
-				layer->object["opacity"] = n_num(layer->opacity);
-				layer->object["blendMode"] = n_num((uint16_t)layer->blendMode);
-				layer->object["children"] = layer->objChildren;
-#endif
+AsepriteReader::FrameIndex AsepriteReader::buildFrameIndex(const uint8_t *in, const uint32_t size)
+{
+	const ByteReader bytes(in, size);
+	if (size < ASEPRITE_HEADER_SIZE || bytes.peekU16(4) != ASEPRITE_MAGIC_NUMBER_FILE)
+		throw ResourceLoadException("Magic number mismatch");
 
-				if (LAYER_CHILD_LEVEL == 0)
-				{
-					// Top layer
-				}
-				else
-				{
-					layer->layerParent = layerLevelMap[LAYER_CHILD_LEVEL - 1];
-					layer->layerParent->layerChildren.push_back(layer);
-#ifdef IS_NODE
-					layer->object["layerParent"] = layer->layerParent->object;
-					obj_push(layer->layerParent->objChildren, layer->object);
-#endif
-				}
+	FrameIndex index;
+	index.fileSize = size;
+	index.frames.resize(bytes.peekU16(6));
 
-				layerLevelMap[LAYER_CHILD_LEVEL] = layer;
-				layerIndex++;
-			}
-			break;
+	uint32_t ptr = ASEPRITE_HEADER_SIZE;
+	for (FrameIndex::Entry &entry : index.frames)
+	{
+		if (size - ptr < 16)
+			throw ResourceLoadException("Unexpected EOF");
 
-			case CHUNK_CEL:
-			{
-				file.cels.push_back(std::make_unique<Cel>());
-				Cel *cel = file.cels.back().get();
+		entry.offset = ptr;
+		entry.size = bytes.peekU32(ptr);
+		if (entry.size < 16 || entry.size > size - ptr)
+			throw ResourceLoadException("Unexpected EOF");
+		if (bytes.peekU16(ptr + 4) != ASEPRITE_MAGIC_NUMBER_FRAME)
+			throw ResourceLoadException("Magic number mismatch");
 
-				const unsigned short LAYER_INDEX = readUInt16(in);
-				if (frame->cels.size() <= LAYER_INDEX)
-					frame->cels.resize(LAYER_INDEX + 1, nullptr);
+		// The 32 bit count replaces the 16 bit one when set
+		const uint32_t chunkCount = bytes.peekU32(ptr + 12);
+		entry.chunkCount = chunkCount ? chunkCount : bytes.peekU16(ptr + 6);
+		entry.duration = bytes.peekU16(ptr + 8);
+		ptr += entry.size;
+	}
+	return index;
+}
 
-				cel->x = readInt16(in);
-				cel->y = readInt16(in);
-				cel->opacity = readUInt8(in);
-				cel->frame = frame;
-				cel->layer = file.layers[LAYER_INDEX].get();
+void AsepriteReader::loadFrames(const uint8_t *in, const uint32_t size, const FrameIndex &index, unsigned first, unsigned last)
+{
+	if (index.fileSize != size)
+		throw ResourceLoadException("Frame index does not match the file");
+	if (first > last || last >= index.frames.size())
+		throw ResourceLoadException("Frame range out of bounds");
 
-				const unsigned short CEL_TYPE = readUInt16(in);
-				skipBytes(in, 7);
+	for (const FrameIndex::Entry &entry : index.frames)
+	{
+		if (entry.offset < ASEPRITE_HEADER_SIZE || entry.size < 16 || entry.size > size - entry.offset)
+			throw ResourceLoadException("Frame index does not match the file");
+	}
 
-				switch (CEL_TYPE)
-				{
-				case CEL_RAW:
-				{
-					cel->w = readUInt16(in);
-					cel->h = readUInt16(in);
+	// The frames of the original cels that the range links to are read too,
+	// their cels skipped but kept as link sources
+	const ByteReader bytes(in, size);
+	FrameSelection frames{index, std::vector<bool>(index.frames.size(), false), first, last};
+	std::vector<bool> &wanted = frames.wanted;
+	wanted[0] = true;
+	for (unsigned i = first; i <= last; i++)
+	{
+		wanted[i] = true;
 
-					const unsigned int CEL_DATA_LENGTH = CHUNK_SIZE - 26;
-					cel->pixels = std::shared_ptr<uint8_t>(readBytes(in, CEL_DATA_LENGTH));
-				}
-				break;
+		const FrameIndex::Entry &entry = index.frames[i];
+		const uint32_t end = entry.offset + entry.size;
+		uint32_t ptr = entry.offset + 16;
 
-				case CEL_LINKED:
-				{
-					const unsigned short CEL_LINK = readUInt16(in);
+		for (uint32_t chunk = 0; chunk < entry.chunkCount && end - ptr >= 6; chunk++)
+		{
+			const uint32_t CHUNK_SIZE = bytes.peekU32(ptr);
+			if (CHUNK_SIZE < 6 || CHUNK_SIZE > end - ptr)
+				break; // readFrame reports it
 
-					cel->pixels = file.frames[CEL_LINK]->cels[LAYER_INDEX]->pixels;
-					cel->w = file.frames[CEL_LINK]->cels[LAYER_INDEX]->w;
-					cel->h = file.frames[CEL_LINK]->cels[LAYER_INDEX]->h;
-					cel->link = CEL_LINK;
-				}
-				break;
+			// Layer, x, y, opacity, cel type, z-index and reserved bytes come
+			// before the frame of a linked cel
+			if (bytes.peekU16(ptr + 4) == CHUNK_CEL && CHUNK_SIZE >= 24 && bytes.peekU16(ptr + 13) == CEL_LINKED)
+			{
+				const uint16_t link = bytes.peekU16(ptr + 22);
+				if (link < wanted.size())
+					wanted[link] = true;
+			}
+			ptr += CHUNK_SIZE;
+		}
+	}
 
-				case CEL_COMPRESSED:
-				{
-					cel->w = readUInt16(in);
-					cel->h = readUInt16(in);
+	read(in, size, false, &frames);
+}
 
-					const unsigned int CEL_DATA_LENGTH = CHUNK_SIZE - 26;
-					std::unique_ptr<uint8_t[]> cpixels(readBytes(in, CEL_DATA_LENGTH));
+void AsepriteReader::loadFileFrames(const std::string &path, const FrameIndex *index, unsigned first, unsigned last)
+{
+	std::shared_ptr<MappedFile> mapped = mapFile(path);
+	const uint32_t size = (uint32_t)mapped->size();
 
-					unsigned long int celDataLengthUncompressed = cel->w * cel->h * bytesPerPixel;
-					cel->pixels = std::shared_ptr<uint8_t>(new uint8_t[celDataLengthUncompressed]);
+	FrameIndex built;
+	if (!index)
+	{
+		built = buildFrameIndex(mapped->data(), size);
+		index = &built;
+	}
 
-					int ret = uncompress(cel->pixels.get(), &celDataLengthUncompressed, cpixels.get(), CEL_DATA_LENGTH);
+	loadFrames(mapped->data(), size, *index, first, last);
+	mapping = options.lazy ? mapped : nullptr;
+}
 
-					if (ret != Z_OK)
-						throw ResourceLoadException("Data decompression failed");
-				}
-				break;
+void AsepriteReader::read(const uint8_t *in, const uint32_t size, bool metadataOnly, const FrameSelection *frames)
+{
+	const FrameIndex *index = frames ? &frames->index : nullptr;
+	Clock::time_point start;
+	if (options.stats)
+	{
+		start = Clock::now();
+		stats = LoadStats();
+	}
 
-				default:
-					throw ResourceLoadException("Invalid/unsupported Aseprite cel type");
-					break;
-				}
+	ParseState state;
+	state.frames = frames;
+	readHeader(in, size);
 
-				frame->cels[LAYER_INDEX] = cel;
+	if (index && index->frames.size() != (size_t)file.numFrames)
+		throw ResourceLoadException("Frame index does not match the file");
 
-#ifdef IS_NODE
-				// cel node object
-				cel->object = newObject;
-				obj_push(objCels, cel->object);
-				cel->object["x"] = n_num(cel->x);
-				cel->object["y"] = n_num(cel->y);
-				cel->object["w"] = n_num(cel->w);
-				cel->object["h"] = n_num(cel->h);
-				cel->object["opacity"] = n_num(cel->opacity);
-				cel->object["frame"] = frame->object;
-				cel->object["layer"] = cel->layer->object;
-
-				if (CEL_TYPE == CEL_LINKED)
-				{
-					cel->objPixels = file.frames[cel->link]->cels[LAYER_INDEX]->objPixels;
-				}
-				else
-				{
-					int dataLength = cel->w * cel->h * (file.colorDepth / 8);
-					cel->objPixels = Uint8Array::New(env, dataLength);
-					uint8_t *pPixel = cel->pixels.get();
-					for (int i = 0; i < dataLength; i++, pPixel++)
-					{
-						cel->objPixels[i] = *pPixel;
-					}
-				}
-				cel->object["pixels"] = cel->objPixels;
+	// Frames are read one by one, each bounded by its size field
+	const ByteReader bytes(in, size);
+	uint32_t ptr = ASEPRITE_HEADER_SIZE;
+	for (int idxFrame = 0; idxFrame < file.numFrames; ++idxFrame)
+	{
+		if (index)
+		{
+			const FrameIndex::Entry &entry = index->frames[idxFrame];
+			ptr = entry.offset;
 
-				frame->objCels[LAYER_INDEX] = cel->object;
-#endif
+			if (!frames->wanted[idxFrame])
+			{
+				// Not read: the duration from the index and no cels
+				Frame *frame = file.frames.emplace_back();
+				frame->duration = entry.duration;
+				frame->cels.resize(file.layers.size(), nullptr);
+				continue;
 			}
-			break;
+		}
 
-			case CHUNK_CELEXTRA:
-				skipBytes(in, CHUNK_SIZE - 4 - 2);
-				break;
+		const uint32_t FRAME_SIZE = bytes.peekU32(ptr);
+		if (FRAME_SIZE > size - ptr)
+			throw ResourceLoadException("Unexpected EOF");
+		if (index && FRAME_SIZE != index->frames[idxFrame].size)
+			throw ResourceLoadException("Frame index does not match the file");
 
-			case CHUNK_FRAME_TAGS:
-			{
-				const unsigned short TAG_COUNT = readUInt16(in);
-				skipBytes(in, 8);
+		readFrame(in + ptr, FRAME_SIZE, state, metadataOnly);
+		ptr += FRAME_SIZE;
+	}
 
-				for (unsigned idxTag = 0u; idxTag < TAG_COUNT; ++idxTag)
-				{
-					file.tags.push_back(std::make_unique<FrameTag>());
-					FrameTag *tag = file.tags.back().get();
+	decodeCels(state);
+	linkTags();
 
-					tag->frameFrom = readUInt16(in);
-					tag->frameTo = readUInt16(in);
-					tag->direction = static_cast<AnimationDirection>(readUInt16(in));
-					skipBytes(in, 7);
+	if (!metadataOnly)
+		setPixelFormat();
 
-					const unsigned int TAG_COLOR = readUInt32(in);
-					tag->color.r = TAG_COLOR & 0xff;
-					tag->color.g = (TAG_COLOR >> 8) & 0xff;
-					tag->color.b = (TAG_COLOR >> 16) & 0xff;
-					tag->color.a = (TAG_COLOR >> 24) & 0xff;
-					tag->name = readString(in, readUInt16(in));
+	if (options.stats)
+	{
+		stats.loadSeconds = secondsSince(start);
+		stats.nativeBytes = memoryFootprint();
+	}
+}
 
-#ifdef IS_NODE
-					// tag node object
-					tag->object = newObject;
-					tag->objFrames = newArray;
-					obj_push(objTags, tag->object);
-					tag->object["from"] = n_num(tag->frameFrom);
-					tag->object["to"] = n_num(tag->frameTo);
-					tag->object["direction"] = n_num((uint8_t)tag->direction);
-					tag->object["name"] = n_str(tag->name);
-					set_color(tag->object["color"], tag->color);
-					tag->object["frames"] = tag->objFrames;
-#endif
-				}
-			}
-			break;
+void AsepriteReader::readHeader(const uint8_t *in, const uint32_t size)
+{
+	ByteReader header(in, size);
+	header.require(ASEPRITE_HEADER_SIZE);
 
-			case CHUNK_PALETTE:
-			{
-				const unsigned long COLOR_COUNT = readUInt32(in);
+	header.skip(4); // File size
 
-				file.palette->paletteSize = COLOR_COUNT;
-				file.palette->firstColor = readUInt32(in);
-				file.palette->lastColor = readUInt32(in);
-				skipBytes(in, 8);
+	if (header.u16() != ASEPRITE_MAGIC_NUMBER_FILE)
+	{
+		throw ResourceLoadException("Magic number mismatch");
+	}
 
-#ifdef IS_NODE
-				// palette node object
-				file.palette->objColors = newArray;
-				objPalette["size"] = n_num(COLOR_COUNT);
-				objPalette["firstColor"] = n_num(file.palette->firstColor);
-				objPalette["lastColor"] = n_num(file.palette->lastColor);
-				objPalette["colors"] = file.palette->objColors;
-#endif
+	file.numFrames = header.u16();
+	file.width = header.u16();
+	file.height = header.u16();
+	file.colorDepth = header.u16();
+	if (file.colorDepth != 8 && file.colorDepth != 16 && file.colorDepth != 32)
+		throw ResourceLoadException("Unsupported color depth");
+	file.palette = std::make_unique<Palette>();
 
-				for (unsigned i = 0u; i < COLOR_COUNT; ++i)
-				{
-					file.palette->colors.push_back(std::make_unique<Color>());
-					Color *color = file.palette->colors.back().get();
-					bool hasName = readUInt16(in) & 1;
+	header.require(4);
+	const uint32_t FILE_FLAGS = header.u32();
+	file.layerOpacity = (FILE_FLAGS & FLAG_FILE_LAYER_OPACITY) != 0;
+	file.groupBlending = (FILE_FLAGS & FLAG_FILE_GROUP_BLENDING) != 0;
+	header.skip(2 + 8); // Deprecated speed
+	file.transparentIndex = header.u8();
+	header.skip(3);
+
+	file.numColors = header.u16();
+	uint8_t pixelWidth = header.u8();
+	uint8_t pixelHeight = header.u8();
+	file.pixelRatio = pixelWidth && pixelHeight ? (double)pixelWidth / (double)pixelHeight : 1.0;
+}
 
-					const unsigned int COLOR = readUInt32(in);
-					color->r = COLOR & 0xff;
-					color->g = (COLOR >> 8) & 0xff;
-					color->b = (COLOR >> 16) & 0xff;
-					color->a = (COLOR >> 24) & 0xff;
+void AsepriteReader::readFrame(const uint8_t *in, const uint32_t size, ParseState &state, bool metadataOnly)
+{
+	// Checked once per frame rather than once per chunk
+	if (options.stats)
+		readChunks<true>(in, size, state, metadataOnly);
+	else
+		readChunks<false>(in, size, state, metadataOnly);
+}
 
-					if (hasName)
-						readString(in, readUInt16(in));
+template <bool Stats>
+void AsepriteReader::readChunks(const uint8_t *in, const uint32_t size, ParseState &state, bool metadataOnly)
+{
+	const unsigned short bytesPerPixel = file.colorDepth / 8;
 
-#ifdef IS_NODE
-					Array objColor = Array::New(env, 4);
-					objColor[0u] = n_num(color->r);
-					objColor[1u] = n_num(color->g);
-					objColor[2u] = n_num(color->b);
-					objColor[3u] = n_num(color->a);
-					obj_push(file.palette->objColors, objColor);
-#endif
-				}
-			}
-			break;
+	ByteReader frameData(in, size);
+	frameData.require(16);
+	frameData.skip(4);
 
-			case CHUNK_USERDATA:
-				skipBytes(in, CHUNK_SIZE - 4 - 2);
-				break;
+	if (frameData.u16() != ASEPRITE_MAGIC_NUMBER_FRAME)
+	{
+		throw ResourceLoadException("Magic number mismatch");
+	}
 
-			case CHUNK_SLICE:
-			{
-				file.slices.push_back(std::make_unique<Slice>());
-				Slice *slice = file.slices.back().get();
+	Frame *frame = file.frames.emplace_back();
 
-				const unsigned int SLICE_KEYS = readUInt32(in);
-				const unsigned int SLICE_FLAGS = readUInt32(in);
-				skipBytes(in, 4);
-				slice->has9Slice = SLICE_FLAGS & FLAG_SLICE_9SLICES;
-				slice->hasPivot = SLICE_FLAGS & FLAG_SLICE_PIVOT;
-				slice->name = readString(in, readUInt16(in));
+	const unsigned short CHUNK_COUNT = frameData.u16();
+	frame->duration = frameData.u16();
+	frameData.skip(6);
 
-#ifdef IS_NODE
-				// slice node object
-				slice->object = newObject;
-				slice->objKeys = newArray;
-				obj_push(objSlices, slice->object);
-				slice->object["name"] = n_str(slice->name);
-				slice->object["has9Slice"] = Boolean::New(env, slice->has9Slice);
-				slice->object["hasPivot"] = Boolean::New(env, slice->hasPivot);
-				slice->object["keys"] = slice->objKeys;
-#endif
+	for (unsigned idxChunk = 0u; idxChunk < CHUNK_COUNT; ++idxChunk)
+	{
+		frameData.require(6);
+		const unsigned int CHUNK_SIZE = frameData.u32();
+		const unsigned short CHUNK_TYPE = frameData.u16();
 
-				for (unsigned i = 0u; i < SLICE_KEYS; i++)
-				{
-					slice->keys.push_back(std::make_unique<SliceKey>());
-					SliceKey *key = slice->keys.back().get();
+		if (CHUNK_SIZE < 6)
+			throw ResourceLoadException("Invalid chunk size");
 
-					key->frame = readUInt32(in);
-					key->x = readUInt32(in);
-					key->y = readUInt32(in);
-					key->w = readUInt32(in);
-					key->h = readUInt32(in);
+		// Reads below stay within the chunk; fields this reader does not know
+		// about (e.g. layer UUIDs) are skipped along with the rest of it
+		ByteReader chunk = frameData.sub(CHUNK_SIZE - 6);
+		const ChunkTimer<Stats> timer(stats, CHUNK_TYPE, CHUNK_SIZE);
 
-#ifdef IS_NODE
-					Object objKey = newObject;
-					objKey["frame"] = n_num(key->frame);
-					objKey["x"] = n_num(key->x);
-					objKey["y"] = n_num(key->y);
-					objKey["w"] = n_num(key->w);
-					objKey["h"] = n_num(key->h);
-					obj_push(slice->objKeys, objKey);
-#endif
+		switch (CHUNK_TYPE)
+		{
+		case CHUNK_LAYER:
+		{
+			Layer *layer = file.layers.emplace_back();
 
-					if (slice->has9Slice)
-					{
-						key->patchX = readUInt32(in);
-						key->patchY = readUInt32(in);
-						key->patchW = readUInt32(in);
-						key->patchH = readUInt32(in);
+			chunk.require(18);
+			const unsigned short LAYER_FLAGS = chunk.u16();
+			const unsigned short LAYER_TYPE = chunk.u16();
 
-#ifdef IS_NODE
-						Object obj9Slice = newObject;
-						obj9Slice["x"] = n_num(key->patchX);
-						obj9Slice["y"] = n_num(key->patchY);
-						obj9Slice["w"] = n_num(key->patchW);
-						obj9Slice["h"] = n_num(key->patchH);
-						objKey["patch"] = obj9Slice;
-#endif
-					}
-					if (slice->hasPivot)
-					{
-						key->pivotX = readUInt32(in);
-						key->pivotY = readUInt32(in);
+			layer->index = state.layerIndex;
+			layer->flags = LAYER_FLAGS;
+			layer->type = LAYER_TYPE;
 
-#ifdef IS_NODE
-						Object objPivot = newObject;
-						objPivot["x"] = n_num(key->pivotX);
-						objPivot["y"] = n_num(key->pivotY);
-						objKey["pivot"] = objPivot;
-#endif
-					}
+			const unsigned short LAYER_CHILD_LEVEL = chunk.u16();
+			chunk.skip(4);
+
+			layer->blendMode = static_cast<BlendMode>(chunk.u16());
+			layer->opacity = chunk.u8();
+			chunk.skip(3);
+			layer->name = chunk.string(chunk.u16());
+
+			if (LAYER_TYPE == LAYER_TILEMAP)
+			{
+				chunk.require(4);
+				layer->tilesetIndex = chunk.u32();
+				for (Tileset *tileset : file.tilesets)
+				{
+					if (tileset->id == layer->tilesetIndex)
+						layer->tileset = tileset;
 				}
 			}
-			break;
 
-			default:
-				skipBytes(in, CHUNK_SIZE - 4 - 2);
-				break;
+			if (LAYER_CHILD_LEVEL == 0)
+			{
+				// Top layer
+			}
+			else
+			{
+				auto parent = state.layerLevelMap.find(LAYER_CHILD_LEVEL - 1);
+				if (parent == state.layerLevelMap.end())
+					throw ResourceLoadException("Invalid layer child level");
+				layer->layerParent = parent->second;
+				layer->layerParent->layerChildren.push_back(layer);
+			}
+
+			state.layerLevelMap[LAYER_CHILD_LEVEL] = layer;
+			state.layerIndex++;
+		}
+		break;
+
+		case CHUNK_CEL:
+		{
+			chunk.require(16);
+			const unsigned short LAYER_INDEX = chunk.u16();
+			if (LAYER_INDEX >= file.layers.size())
+				throw ResourceLoadException("Invalid cel layer");
+
+			// Skipped cels are read all the same, keeping where their data is,
+			// but are neither decoded nor added to the file
+			const unsigned FRAME_INDEX = (unsigned)file.frames.size() - 1;
+			const bool selected = celSelected(state, FRAME_INDEX, file.layers[LAYER_INDEX]);
+			Cel *cel = selected ? file.cels.emplace_back() : state.skippedCels.emplace_back();
+
+			if (selected && frame->cels.size() <= LAYER_INDEX)
+				frame->cels.resize(LAYER_INDEX + 1, nullptr);
+
+			cel->x = chunk.i16();
+			cel->y = chunk.i16();
+			cel->opacity = chunk.u8();
+			cel->frame = frame;
+			cel->layer = file.layers[LAYER_INDEX];
+
+			const unsigned short CEL_TYPE = chunk.u16();
+			chunk.skip(7);
+
+			switch (CEL_TYPE)
+			{
+			case CEL_RAW:
+			{
+				chunk.require(4);
+				cel->w = chunk.u16();
+				cel->h = chunk.u16();
+
+				const unsigned int CEL_DATA_LENGTH = (unsigned int)chunk.remaining();
+				const uint8_t *celData = chunk.current();
+
+				if (metadataOnly)
+					break;
+
+				cel->pixelsLength = (size_t)cel->w * cel->h * bytesPerPixel;
+
+				if (options.lazy || !selected)
+				{
+					cel->source = celData;
+					cel->sourceLength = CEL_DATA_LENGTH;
+					break;
+				}
+
+				state.pendingCels.push_back({cel, celData, CEL_DATA_LENGTH, false});
+			}
+			break;
+
+			case CEL_LINKED:
+			{
+				chunk.require(2);
+				const unsigned short CEL_LINK = chunk.u16();
+				unsigned linkFrame = CEL_LINK;
+				Cel *linkedCel = nullptr;
+				if (CEL_LINK < file.frames.size() && LAYER_INDEX < file.frames[CEL_LINK]->cels.size())
+					linkedCel = file.frames[CEL_LINK]->cels[LAYER_INDEX];
+
+				bool linkedSkipped = false;
+				if (!linkedCel)
+				{
+					auto skipped = state.skippedCelMap.find({CEL_LINK, LAYER_INDEX});
+					if (skipped == state.skippedCelMap.end())
+						throw ResourceLoadException("Invalid cel link");
+					linkedCel = skipped->second;
+
+					// A skipped linked cel holds no data, the cel it links to
+					// does. Links are resolved as they are read, so that one
+					// never links further.
+					if (linkedCel->linkedCel)
+					{
+						linkFrame = (unsigned)linkedCel->link;
+						linkedCel = linkedCel->linkedCel;
+					}
+					linkedSkipped = !(LAYER_INDEX < file.frames[linkFrame]->cels.size() && file.frames[linkFrame]->cels[LAYER_INDEX] == linkedCel);
+				}
+
+				cel->pixelsLength = linkedCel->pixelsLength;
+				cel->w = linkedCel->w;
+				cel->h = linkedCel->h;
+				cel->tilemap = linkedCel->tilemap;
+
+				if (selected && linkedSkipped)
+				{
+					// The cel takes over the data of the skipped one
+					memcpy(cel->tileMasks, linkedCel->tileMasks, sizeof(cel->tileMasks));
+					if (metadataOnly)
+						break;
+					if (!linkedCel->source)
+						throw ResourceLoadException("Invalid cel link");
+
+					if (options.lazy)
+					{
+						cel->source = linkedCel->source;
+						cel->sourceLength = linkedCel->sourceLength;
+						cel->sourceCompressed = linkedCel->sourceCompressed;
+						break;
+					}
+
+					state.pendingCels.push_back({cel, linkedCel->source, linkedCel->sourceLength, linkedCel->sourceCompressed});
+					break;
+				}
+
+				// Pixels are shared once the linked cel is decoded
+				if (selected)
+					state.linkedCels.push_back(cel);
+				cel->link = linkFrame;
+				cel->linkedCel = linkedCel;
+			}
+			break;
+
+			case CEL_COMPRESSED:
+			{
+				chunk.require(4);
+				cel->w = chunk.u16();
+				cel->h = chunk.u16();
+
+				const unsigned int CEL_DATA_LENGTH = (unsigned int)chunk.remaining();
+				const uint8_t *celData = chunk.current();
+
+				if (metadataOnly)
+					break;
+
+				cel->pixelsLength = (size_t)cel->w * cel->h * bytesPerPixel;
+
+				if (options.lazy || !selected)
+				{
+					cel->source = celData;
+					cel->sourceLength = CEL_DATA_LENGTH;
+					cel->sourceCompressed = true;
+					break;
+				}
+
+				state.pendingCels.push_back({cel, celData, CEL_DATA_LENGTH, true});
+			}
+			break;
+
+			case CEL_COMPRESSED_TILEMAP:
+			{
+				chunk.require(32);
+				cel->w = chunk.u16();
+				cel->h = chunk.u16();
+				cel->tilemap = true;
+
+				if (chunk.u16() != 32)
+					throw ResourceLoadException("Unsupported tile size");
+				for (uint32_t &mask : cel->tileMasks)
+					mask = chunk.u32();
+				chunk.skip(10);
+
+				const unsigned int CEL_DATA_LENGTH = (unsigned int)chunk.remaining();
+				const uint8_t *celData = chunk.current();
+
+				if (metadataOnly)
+					break;
+
+				cel->pixelsLength = (size_t)cel->w * cel->h * 4;
+
+				if (options.lazy || !selected)
+				{
+					cel->source = celData;
+					cel->sourceLength = CEL_DATA_LENGTH;
+					cel->sourceCompressed = true;
+					break;
+				}
+
+				state.pendingCels.push_back({cel, celData, CEL_DATA_LENGTH, true});
+			}
+			break;
+
+			default:
+				throw ResourceLoadException("Invalid/unsupported Aseprite cel type");
+				break;
+			}
+
+			if (selected)
+				frame->cels[LAYER_INDEX] = cel;
+			else
+				state.skippedCelMap[{FRAME_INDEX, LAYER_INDEX}] = cel;
+		}
+		break;
+
+		case CHUNK_FRAME_TAGS:
+		{
+			chunk.require(10);
+			const unsigned short TAG_COUNT = chunk.u16();
+			chunk.skip(8);
+
+			for (unsigned idxTag = 0u; idxTag < TAG_COUNT; ++idxTag)
+			{
+				FrameTag *tag = file.tags.emplace_back();
+
+				chunk.require(19);
+				tag->frameFrom = chunk.u16();
+				tag->frameTo = chunk.u16();
+				tag->direction = static_cast<AnimationDirection>(chunk.u16());
+				chunk.skip(7);
+
+				const unsigned int TAG_COLOR = chunk.u32();
+				tag->color.r = TAG_COLOR & 0xff;
+				tag->color.g = (TAG_COLOR >> 8) & 0xff;
+				tag->color.b = (TAG_COLOR >> 16) & 0xff;
+				tag->color.a = (TAG_COLOR >> 24) & 0xff;
+				tag->name = chunk.string(chunk.u16());
+			}
+			state.tagsRead = true;
+		}
+		break;
+
+		case CHUNK_PALETTE:
+		{
+			chunk.require(20);
+			const unsigned long COLOR_COUNT = chunk.u32();
+
+			file.palette->paletteSize = COLOR_COUNT;
+			file.palette->firstColor = chunk.u32();
+			file.palette->lastColor = chunk.u32();
+			chunk.skip(8);
+
+			// Entries take 6 bytes at least, which bounds the count
+			file.palette->colors.reserve(file.palette->colors.size() + std::min<size_t>(COLOR_COUNT, chunk.remaining() / 6));
+
+			for (unsigned i = 0u; i < COLOR_COUNT; ++i)
+			{
+				chunk.require(6);
+				file.palette->colors.emplace_back();
+				Color *color = &file.palette->colors.back();
+				bool hasName = chunk.u16() & 1;
+
+				const unsigned int COLOR = chunk.u32();
+				color->r = COLOR & 0xff;
+				color->g = (COLOR >> 8) & 0xff;
+				color->b = (COLOR >> 16) & 0xff;
+				color->a = (COLOR >> 24) & 0xff;
+
+				if (hasName)
+				{
+					chunk.require(2);
+					chunk.skip(chunk.u16());
+				}
+			}
+		}
+		break;
+
+		case CHUNK_SLICE:
+		{
+			Slice *slice = file.slices.emplace_back();
+
+			chunk.require(14);
+			const unsigned int SLICE_KEYS = chunk.u32();
+			const unsigned int SLICE_FLAGS = chunk.u32();
+			chunk.skip(4);
+			slice->has9Slice = SLICE_FLAGS & FLAG_SLICE_9SLICES;
+			slice->hasPivot = SLICE_FLAGS & FLAG_SLICE_PIVOT;
+			slice->name = chunk.string(chunk.u16());
+
+			const size_t KEY_SIZE = 20 + (slice->has9Slice ? 16 : 0) + (slice->hasPivot ? 8 : 0);
+			slice->keys.reserve(std::min<size_t>(SLICE_KEYS, chunk.remaining() / KEY_SIZE));
+
+			for (unsigned i = 0u; i < SLICE_KEYS; i++)
+			{
+				chunk.require(KEY_SIZE);
+				slice->keys.emplace_back();
+				SliceKey *key = &slice->keys.back();
+
+				key->frame = chunk.u32();
+				key->x = chunk.i32();
+				key->y = chunk.i32();
+				key->w = chunk.u32();
+				key->h = chunk.u32();
+
+				if (slice->has9Slice)
+				{
+					key->patchX = chunk.i32();
+					key->patchY = chunk.i32();
+					key->patchW = chunk.u32();
+					key->patchH = chunk.u32();
+				}
+				if (slice->hasPivot)
+				{
+					key->pivotX = chunk.i32();
+					key->pivotY = chunk.i32();
+				}
+			}
+		}
+		break;
+
+		case CHUNK_TILESET:
+		{
+			Tileset *tileset = file.tilesets.emplace_back();
+
+			chunk.require(34);
+			tileset->id = chunk.u32();
+			tileset->flags = chunk.u32();
+			tileset->numTiles = chunk.u32();
+			tileset->tileWidth = chunk.u16();
+			tileset->tileHeight = chunk.u16();
+			tileset->baseIndex = chunk.i16();
+			chunk.skip(14);
+			tileset->name = chunk.string(chunk.u16());
+
+			// Layers usually come after their tileset, but not necessarily
+			for (Layer *layer : file.layers)
+			{
+				if (layer->type == LAYER_TILEMAP && layer->tilesetIndex == tileset->id)
+					layer->tileset = tileset;
+			}
+
+			if (tileset->flags & FLAG_TILESET_EXTERNAL)
+				chunk.skip(8); // External file and tileset ids
+
+			if (tileset->flags & FLAG_TILESET_TILES)
+			{
+				chunk.require(4);
+				const unsigned int DATA_LENGTH = chunk.u32();
+				const uint8_t *data = chunk.current();
+				chunk.skip(DATA_LENGTH);
+
+				// Tiles are decoded up front even for lazy loads: every
+				// tilemap cel draws from them
+				if (!metadataOnly)
+				{
+					tileset->pixelsLength = (size_t)tileset->tileWidth * tileset->tileHeight * tileset->numTiles * bytesPerPixel;
+					state.pendingTilesets.push_back({tileset, data, DATA_LENGTH});
+				}
 			}
 		}
+		break;
 
-		frame->cels.resize(file.layers.size(), nullptr);
+		default:
+			// Cel extra, user data and the rest need nothing from the chunk
+			break;
+		}
+	}
+
+	frame->cels.resize(file.layers.size(), nullptr);
+}
+
+bool AsepriteReader::celSelected(const ParseState &state, unsigned frameIndex, const Layer *layer) const
+{
+	if (state.frames && (frameIndex < state.frames->first || frameIndex > state.frames->last))
+		return false;
+	if (!options.selects())
+		return true;
+
+	if ((int)frameIndex < options.firstFrame || (options.lastFrame >= 0 && (int)frameIndex > options.lastFrame))
+		return false;
+
+	// Aseprite writes tags before the first cel, cels met earlier are kept
+	if (!options.tags.empty() && state.tagsRead)
+	{
+		bool inTag = false;
+		for (const FrameTag *tag : file.tags)
+		{
+			if ((int)frameIndex >= tag->frameFrom && (int)frameIndex <= tag->frameTo &&
+				std::find(options.tags.begin(), options.tags.end(), tag->name) != options.tags.end())
+				inTag = true;
+		}
+		if (!inTag)
+			return false;
+	}
+
+	bool named = options.layers.empty();
+	for (const Layer *item = layer; item; item = item->layerParent)
+	{
+		if (options.visibleOnly && (!(item->flags & LAYER_FLAG_VISIBLE) || (item->flags & LAYER_FLAG_REFERENCE)))
+			return false;
+		if (!named && std::find(options.layers.begin(), options.layers.end(), item->name) != options.layers.end())
+			named = true;
+	}
+	return named;
+}
+
+void AsepriteReader::decodeCels(ParseState &state)
+{
+	std::vector<PendingCel> &pendingCels = state.pendingCels;
+
+	// With an output format, cels are decoded to a scratch buffer and
+	// converted into the block. file.colorDepth still describes the file
+	// here, setPixelFormat describes the output once every frame is read.
+	const int colorDepth = file.colorDepth;
+	const PixelFormat format = options.lazy ? PixelFormat::NATIVE : options.outputFormat();
+	const PixelConverter convert = format == PixelFormat::RGBA8 && colorDepth == 32 ? nullptr : pixelConverter(colorDepth, format);
+	const bool expand = convert != nullptr;
+	const size_t outputBytes = pixelFormatBytes(format, colorDepth);
+	const bool dedup = options.dedup && !options.lazy;
+
+	// With dedup, cels stored twice are decoded once: same data, size and
+	// decoding as an earlier cel. They get its pixels at the end.
+	std::vector<std::pair<Cel *, Cel *>> storedTwice; // cel, earlier cel
+	if (dedup && pendingCels.size() > 1)
+	{
+		std::vector<uint64_t> hashes(pendingCels.size());
+		for (size_t i = 0; i < pendingCels.size(); i++)
+			hashes[i] = xxHash64(pendingCels[i].data, pendingCels[i].length);
+
+		auto background = [](const Cel *cel) { return cel->layer && (cel->layer->flags & LAYER_FLAG_BACKGROUND); };
+		auto same = [&pendingCels, &background](size_t a, size_t b)
+		{
+			const PendingCel &x = pendingCels[a];
+			const PendingCel &y = pendingCels[b];
+			return x.length == y.length && x.compressed == y.compressed && x.cel->w == y.cel->w && x.cel->h == y.cel->h &&
+				x.cel->tilemap == y.cel->tilemap && !memcmp(x.cel->tileMasks, y.cel->tileMasks, sizeof(x.cel->tileMasks)) &&
+				background(x.cel) == background(y.cel) && !memcmp(x.data, y.data, x.length);
+		};
+
+		std::vector<bool> duplicate(pendingCels.size(), false);
+		for (const auto &found : findDuplicates(hashes, same))
+		{
+			storedTwice.push_back({pendingCels[found.first].cel, pendingCels[found.second].cel});
+			duplicate[found.first] = true;
+		}
+
+		size_t kept = 0;
+		for (size_t i = 0; i < pendingCels.size(); i++)
+		{
+			if (!duplicate[i])
+				pendingCels[kept++] = pendingCels[i];
+		}
+		pendingCels.resize(kept);
+	}
+
+	Clock::time_point start;
+	if (options.stats)
+	{
+		start = Clock::now();
+		for (const PendingCel &item : pendingCels)
+		{
+			if (!item.compressed)
+				continue;
+			stats.compressedBytes += item.length;
+			stats.decompressedBytes += (size_t)item.cel->w * item.cel->h * (item.cel->tilemap ? 4 : colorDepth / 8);
+		}
+		for (const PendingTileset &item : state.pendingTilesets)
+		{
+			stats.compressedBytes += item.length;
+			stats.decompressedBytes += item.tileset->pixelsLength;
+		}
+	}
+
+	uint32_t luts[2][256];
+	if (expand)
+	{
+		if (colorDepth == 8)
+		{
+			buildFormatLUT(file, false, format, luts[0]);
+			buildFormatLUT(file, true, format, luts[1]);
+		}
+		for (const PendingCel &item : pendingCels)
+		{
+			if (!item.cel->tilemap)
+				item.cel->pixelsLength = (size_t)item.cel->w * item.cel->h * outputBytes;
+		}
+	}
+
+	// Tilesets and cels share one block, each through an aliasing shared_ptr:
+	// no allocation per cel, and the block goes away with the last reference
+	if (!pendingCels.empty() || !state.pendingTilesets.empty())
+	{
+		size_t total = 0;
+		for (const PendingTileset &item : state.pendingTilesets)
+		{
+			Tileset *tileset = item.tileset;
+			if (expand)
+				tileset->pixelsLength = (size_t)tileset->tileWidth * tileset->tileHeight * tileset->numTiles * outputBytes;
+			total += alignPixels(tileset->pixelsLength);
+		}
+		for (const PendingCel &item : pendingCels)
+			total += alignPixels(item.cel->pixelsLength);
+
+		std::shared_ptr<uint8_t> block = allocPixels(std::max<size_t>(total, 1));
+		size_t offset = 0;
+
+		for (const PendingTileset &item : state.pendingTilesets)
+		{
+			item.tileset->pixels = std::shared_ptr<uint8_t>(block, block.get() + offset);
+			offset += alignPixels(item.tileset->pixelsLength);
+		}
+		for (const PendingCel &item : pendingCels)
+		{
+			item.cel->pixels = std::shared_ptr<uint8_t>(block, block.get() + offset);
+			offset += alignPixels(item.cel->pixelsLength);
+		}
+
+		pixelBlocks.push_back({block, total});
+	}
+
+	// Tilesets are few, and decoded one at a time
+	for (const PendingTileset &item : state.pendingTilesets)
+	{
+		Tileset *tileset = item.tileset;
+		const size_t count = (size_t)tileset->tileWidth * tileset->tileHeight * tileset->numTiles;
+		const size_t length = count * (colorDepth / 8);
+		std::vector<uint8_t> decoded(expand ? length : 0);
+
+		uint8_t *target = expand ? decoded.data() : tileset->pixels.get();
+		if (!inflatePixels(target, length, item.data, item.length))
+			throw ResourceLoadException("Tileset decompression failed");
+
+		// Tilemap layers cannot be background layers
+		if (expand)
+			convert(tileset->pixels.get(), decoded.data(), count, luts[0]);
+	}
+
+	parallelFor(pendingCels.size(), options.threads, [&pendingCels, &luts, colorDepth, convert, expand](size_t i)
+	{
+		const PendingCel &item = pendingCels[i];
+		uint8_t *pixels = item.cel->pixels.get();
+		size_t length = item.cel->pixelsLength;
+
+		// Tiles are indexes, not colors
+		const bool expandCel = expand && !item.cel->tilemap;
+
+		// Reused across cels, but a large one is not kept past its cel so that
+		// idle workers do not hold on to the biggest cel they ever converted
+		const size_t SCRATCH_KEPT = 1 << 20;
+		thread_local std::vector<uint8_t> scratch;
+		if (expandCel)
+		{
+			length = (size_t)item.cel->w * item.cel->h * (colorDepth / 8);
+			scratch.resize(length);
+			pixels = scratch.data();
+		}
+		auto releaseScratch = [&]()
+		{
+			if (scratch.capacity() > SCRATCH_KEPT)
+			{
+				scratch.clear();
+				scratch.shrink_to_fit();
+			}
+		};
+
+		if (!item.compressed)
+			copyRawPixels(pixels, length, item.data, item.length);
+		else if (!inflatePixels(pixels, length, item.data, item.length))
+		{
+			releaseScratch();
+			throw ResourceLoadException("Data decompression failed");
+		}
+
+		if (item.cel->tilemap)
+		{
+			normalizeTiles(pixels, length / 4, item.cel->tileMasks);
+		}
+		else if (expandCel)
+		{
+			const bool background = item.cel->layer && (item.cel->layer->flags & LAYER_FLAG_BACKGROUND);
+			convert(item.cel->pixels.get(), pixels, length / (colorDepth / 8), luts[background]);
+			releaseScratch();
+		}
+	});
+
+	if (dedup && pendingCels.size() > 1)
+		shareDuplicates(state);
+
+	for (const auto &item : storedTwice)
+	{
+		Cel *original = item.second->duplicateOf ? item.second->duplicateOf : item.second;
+		item.first->pixels = original->pixels;
+		item.first->pixelsLength = original->pixelsLength;
+		item.first->duplicateOf = original;
+	}
+
+	if (options.stats && dedup)
+	{
+		auto countCel = [this](const Cel *cel)
+		{
+			stats.celBytes += cel->pixelsLength;
+			if (cel->duplicateOf)
+			{
+				stats.dedupCels++;
+				stats.dedupBytes += cel->pixelsLength;
+			}
+		};
+		for (const PendingCel &item : pendingCels)
+			countCel(item.cel);
+		for (const auto &item : storedTwice)
+			countCel(item.first);
 	}
 
-	// Tag frames
+	for (Cel *cel : state.linkedCels)
+	{
+		cel->pixels = cel->linkedCel->pixels;
+		cel->pixelsLength = cel->linkedCel->pixelsLength;
+	}
+
+	pendingCels.clear();
+	state.pendingTilesets.clear();
+	state.linkedCels.clear();
+
+	if (options.stats)
+		stats.decodeSeconds += secondsSince(start);
+}
+
+void AsepriteReader::shareDuplicates(ParseState &state)
+{
+	std::vector<PendingCel> &pendingCels = state.pendingCels;
+
+	// Seeded with the size, so that cels with the same bytes in another
+	// shape do not collide
+	std::vector<uint64_t> hashes(pendingCels.size());
+	parallelFor(pendingCels.size(), options.threads, [&pendingCels, &hashes](size_t i)
+	{
+		const Cel *cel = pendingCels[i].cel;
+		hashes[i] = xxHash64(cel->pixels.get(), cel->pixelsLength, ((uint64_t)cel->w << 32) ^ cel->h ^ (cel->tilemap ? 1ull << 63 : 0));
+	});
+
+	const std::vector<std::pair<size_t, size_t>> duplicates = findDuplicates(hashes, [&pendingCels](size_t a, size_t b)
+	{
+		const Cel *x = pendingCels[a].cel;
+		const Cel *y = pendingCels[b].cel;
+		return x->w == y->w && x->h == y->h && x->tilemap == y->tilemap && x->pixelsLength == y->pixelsLength &&
+			!memcmp(x->pixels.get(), y->pixels.get(), x->pixelsLength);
+	});
+	if (duplicates.empty())
+		return;
+
+	for (const auto &found : duplicates)
+		pendingCels[found.first].cel->duplicateOf = pendingCels[found.second].cel;
+
+	// The block was sized before the pixels were known: the tilesets and
+	// the cels kept move to one that fits them
+	size_t total = 0;
+	for (const PendingTileset &item : state.pendingTilesets)
+		total += alignPixels(item.tileset->pixelsLength);
+	for (const PendingCel &item : pendingCels)
+	{
+		if (!item.cel->duplicateOf)
+			total += alignPixels(item.cel->pixelsLength);
+	}
+
+	std::shared_ptr<uint8_t> block = allocPixels(std::max<size_t>(total, 1));
+	size_t offset = 0;
+	auto move = [&block, &offset](std::shared_ptr<uint8_t> &pixels, size_t length)
+	{
+		memcpy(block.get() + offset, pixels.get(), length);
+		pixels = std::shared_ptr<uint8_t>(block, block.get() + offset);
+		offset += alignPixels(length);
+	};
+
+	for (const PendingTileset &item : state.pendingTilesets)
+		move(item.tileset->pixels, item.tileset->pixelsLength);
+	for (const PendingCel &item : pendingCels)
+	{
+		if (!item.cel->duplicateOf)
+			move(item.cel->pixels, item.cel->pixelsLength);
+	}
+	for (const PendingCel &item : pendingCels)
+	{
+		if (item.cel->duplicateOf)
+			item.cel->pixels = item.cel->duplicateOf->pixels;
+	}
+
+	pixelBlocks.back() = {block, total};
+}
+
+size_t AsepriteReader::memoryFootprint() const
+{
+	size_t bytes = sizeof(AsepriteReader);
+
+	for (const Frame *frame : file.frames)
+		bytes += sizeof(Frame) + (frame->cels.size() + frame->tags.size()) * sizeof(void *);
+	for (const FrameTag *tag : file.tags)
+		bytes += sizeof(FrameTag) + tag->name.size() + tag->frames.size() * sizeof(void *);
+	for (const Layer *layer : file.layers)
+		bytes += sizeof(Layer) + layer->name.size() + layer->layerChildren.size() * sizeof(void *);
+	for (const Slice *slice : file.slices)
+		bytes += sizeof(Slice) + slice->name.size() + slice->keys.size() * sizeof(SliceKey);
+	for (const Tileset *tileset : file.tilesets)
+		bytes += sizeof(Tileset) + tileset->name.size() + tileset->pixelsLength;
+
+	// Linked and duplicate cels share the pixels of another cel
+	for (const Cel *cel : file.cels)
+		bytes += sizeof(Cel) + (cel->linkedCel || cel->duplicateOf ? 0 : cel->pixelsLength);
+
+	if (file.palette)
+		bytes += sizeof(Palette) + file.palette->colors.size() * 4;
+
+	return bytes;
+}
+
+void AsepriteReader::setPixelFormat()
+{
+	const PixelFormat format = options.lazy ? PixelFormat::NATIVE : options.outputFormat();
+	if (format == PixelFormat::NATIVE)
+		return;
+
+	file.colorDepth = (uint8_t)(pixelFormatBytes(format, file.colorDepth) * 8);
+	file.pixelFormat = format;
+}
+
+void AsepriteReader::linkTags()
+{
 	for (auto &tag : file.tags)
 	{
+		if (tag->frameTo >= (int)file.frames.size())
+			throw ResourceLoadException("Invalid tag frame range");
+
 		for (int i = tag->frameFrom; i <= tag->frameTo; ++i)
 		{
-			tag->frames.push_back(file.frames[i].get());
-			file.frames[i]->tags.push_back(tag.get());
+			tag->frames.push_back(file.frames[i]);
+			file.frames[i]->tags.push_back(tag);
+		}
+	}
+}
 
 #ifdef IS_NODE
-			obj_push(tag->objFrames, file.frames[i]->object);
-			obj_push(file.frames[i]->objTags, tag->object);
+ArrayBuffer AsepriteReader::pixelBuffer(Env env, const std::shared_ptr<uint8_t> &pixels, size_t length)
+{
+#ifdef NODE_API_NO_EXTERNAL_BUFFERS_ALLOWED
+	ArrayBuffer buffer = ArrayBuffer::New(env, length);
+	memcpy(buffer.Data(), pixels.get(), length);
+	return buffer;
+#else
+	if (!length)
+		return ArrayBuffer::New(env, 0);
+
+	auto *hint = new std::shared_ptr<uint8_t>(pixels);
+	return ArrayBuffer::New(
+		env, pixels.get(), length,
+		[](Env, void *, std::shared_ptr<uint8_t> *hint)
+		{ delete hint; },
+		hint);
 #endif
+}
+
+static Value GetCelPixels(const CallbackInfo &info)
+{
+	Env env = info.Env();
+	AsepriteReader::Cel *cel = static_cast<AsepriteReader::Cel *>(info.Data());
+	std::shared_ptr<uint8_t> pixels;
+
+	try
+	{
+		pixels = cel->getPixels();
+	}
+	catch (const std::exception &e)
+	{
+		Error::New(env, e.what()).ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	if (!pixels)
+		return env.Undefined();
+
+	ArrayBuffer buffer = AsepriteReader::pixelBuffer(env, pixels, cel->pixelsLength);
+	return Uint8Array::New(env, cel->pixelsLength, buffer, 0);
+}
+
+static Value ReleaseCelPixels(const CallbackInfo &info)
+{
+	static_cast<AsepriteReader::Cel *>(info.Data())->releasePixels();
+	return info.Env().Undefined();
+}
+
+// cel.toRGBA(): the cel pixels as RGBA, expanded from indexed or grayscale
+// data. Reaches the reader through the cel's hidden document reference.
+static Value CelToRGBA(const CallbackInfo &info)
+{
+	Env env = info.Env();
+	AsepriteReader::Cel *cel = static_cast<AsepriteReader::Cel *>(info.Data());
+	AsepriteReader::Document *document = info.This().IsObject() ? AsepriteReader::Document::unwrap(env, info.This().As<Object>().Get("_document")) : nullptr;
+
+	if (!document)
+	{
+		TypeError::New(env, "toRGBA must be called on a cel").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	std::shared_ptr<uint8_t> pixels;
+	size_t length = 0;
+	try
+	{
+		pixels = document->reader->toRGBA(cel, &length);
+	}
+	catch (const std::exception &e)
+	{
+		Error::New(env, e.what()).ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	if (!pixels)
+		return env.Undefined();
+
+	return Uint8Array::New(env, length, AsepriteReader::pixelBuffer(env, pixels, length), 0);
+}
+
+void AsepriteReader::Document::wrap(Env env, Object object, std::shared_ptr<AsepriteReader> reader)
+{
+	Document *document = new Document();
+	document->reader = std::move(reader);
+	document->self = Weak(object);
+
+	napi_wrap(
+		env, object, document,
+		[](napi_env, void *data, void *)
+		{ delete static_cast<Document *>(data); },
+		nullptr, nullptr);
+}
+
+AsepriteReader::Document *AsepriteReader::Document::unwrap(Env env, Value value)
+{
+	void *document = nullptr;
+	if (!value.IsObject() || napi_unwrap(env, value, &document) != napi_ok)
+		return nullptr;
+	return static_cast<Document *>(document);
+}
+
+// Getters of the toObject result, in property order
+enum DocumentProperty
+{
+	DOCUMENT_FRAMES,
+	DOCUMENT_TAGS,
+	DOCUMENT_LAYERS,
+	DOCUMENT_CELS,
+	DOCUMENT_SLICES,
+	DOCUMENT_TILESETS,
+	DOCUMENT_PALETTE,
+	DOCUMENT_PROPERTY_COUNT,
+};
+
+static const char *const DOCUMENT_PROPERTY_NAMES[DOCUMENT_PROPERTY_COUNT] = {
+	"frames", "tags", "layers", "cels", "slices", "tilesets", "palette"};
+
+// Getters are configurable so that their first call can replace them
+static const napi_property_attributes LAZY_PROPERTY = static_cast<napi_property_attributes>(napi_enumerable | napi_configurable);
+static const napi_property_attributes PLAIN_PROPERTY = static_cast<napi_property_attributes>(napi_writable | napi_enumerable | napi_configurable);
+
+// Turns the getter `name` of `object` into a plain property holding `value`
+static Value memoize(Object object, const char *name, Value value)
+{
+	object.DefineProperty(PropertyDescriptor::Value(name, value, PLAIN_PROPERTY));
+	return value;
+}
+
+// Object of a record if it was built for the document and is still alive
+static Object findObject(AsepriteReader::Document &document, const void *record)
+{
+	auto found = document.objects.find(record);
+	return found == document.objects.end() ? Object() : found->second.Value();
+}
+
+static void keepObject(AsepriteReader::Document &document, const void *record, Object object)
+{
+	document.objects[record] = Weak(object);
+}
+
+Value AsepriteReader::getDocumentProperty(const CallbackInfo &info)
+{
+	Env env = info.Env();
+	Document *document = Document::unwrap(env, info.This());
+	const int property = (int)reinterpret_cast<uintptr_t>(info.Data());
+
+	if (!document)
+	{
+		TypeError::New(env, "Expected a parsed Aseprite object").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	Value value = document->reader->documentProperty(env, *document, property);
+	return memoize(info.This().As<Object>(), DOCUMENT_PROPERTY_NAMES[property], value);
+}
+
+Value AsepriteReader::getFrameCels(const CallbackInfo &info)
+{
+	Env env = info.Env();
+	Document *document = info.This().IsObject() ? Document::unwrap(env, info.This().As<Object>().Get("_document")) : nullptr;
+
+	if (!document)
+	{
+		TypeError::New(env, "Expected a frame").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	Frame *frame = static_cast<Frame *>(info.Data());
+	return memoize(info.This().As<Object>(), "cels", document->reader->frameCels(env, *document, frame));
+}
+
+Value AsepriteReader::getFrameTags(const CallbackInfo &info)
+{
+	Env env = info.Env();
+	Document *document = info.This().IsObject() ? Document::unwrap(env, info.This().As<Object>().Get("_document")) : nullptr;
+
+	if (!document)
+	{
+		TypeError::New(env, "Expected a frame").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	Frame *frame = static_cast<Frame *>(info.Data());
+	return memoize(info.This().As<Object>(), "tags", document->reader->frameTags(env, *document, frame));
+}
+
+Object AsepriteReader::toObject(Env env)
+{
+	Clock::time_point start;
+	if (options.stats)
+		start = Clock::now();
+	stats.jsObjects = 0;
+
+	// general node object
+	Object object = newObject;
+	object["width"] = n_num(file.width);
+	object["height"] = n_num(file.height);
+	object["colorDepth"] = n_num(file.colorDepth);
+	object["pixelFormat"] = n_str(pixelFormatName(file.pixelFormat));
+	object["numFrames"] = n_num(file.numFrames);
+	object["numColors"] = n_num(file.numColors);
+	object["pixelRatio"] = n_num(file.pixelRatio);
+
+	// records are built on first access
+	std::vector<PropertyDescriptor> getters;
+	for (int property = 0; property < DOCUMENT_PROPERTY_COUNT; property++)
+	{
+		void *data = reinterpret_cast<void *>((uintptr_t)property);
+		getters.push_back(PropertyDescriptor::Accessor<getDocumentProperty>(DOCUMENT_PROPERTY_NAMES[property], LAZY_PROPERTY, data));
+	}
+	object.DefineProperties(getters);
+
+	if (options.stats)
+		stats.objectSeconds = secondsSince(start);
+
+	return object;
+}
+
+Value AsepriteReader::documentProperty(Env env, Document &document, int property)
+{
+	if (property == DOCUMENT_PALETTE)
+	{
+		// palette node object
+		Object objPalette = newObject;
+		Array objColors = newArray;
+		objPalette["size"] = n_num(file.palette->paletteSize);
+		objPalette["firstColor"] = n_num(file.palette->firstColor);
+		objPalette["lastColor"] = n_num(file.palette->lastColor);
+		objPalette["colors"] = objColors;
+
+		for (auto &color : file.palette->colors)
+		{
+			Array objColor = Array::New(env, 4);
+			countObjects(1);
+			objColor[0u] = n_num(color.r);
+			objColor[1u] = n_num(color.g);
+			objColor[2u] = n_num(color.b);
+			objColor[3u] = n_num(color.a);
+			obj_push(objColors, objColor);
+		}
+		return objPalette;
+	}
+
+	Array array = newArray;
+
+	switch (property)
+	{
+	case DOCUMENT_FRAMES:
+		for (auto &frame : file.frames)
+			obj_push(array, frameObject(env, document, frame));
+		break;
+	case DOCUMENT_TAGS:
+		for (auto &tag : file.tags)
+			obj_push(array, tagObject(env, document, tag));
+		break;
+	case DOCUMENT_LAYERS:
+		for (auto &layer : file.layers)
+			obj_push(array, layerObject(env, document, layer));
+		break;
+	case DOCUMENT_CELS:
+		for (auto &cel : file.cels)
+			obj_push(array, celObject(env, document, cel));
+		break;
+	case DOCUMENT_TILESETS:
+		for (auto &tileset : file.tilesets)
+			obj_push(array, tilesetObject(env, document, tileset));
+		break;
+	case DOCUMENT_SLICES:
+		for (auto &slice : file.slices)
+		{
+			// slice node object
+			Object objSlice = newObject;
+			Array objKeys = newArray;
+			obj_push(array, objSlice);
+			objSlice["name"] = n_str(slice->name);
+			objSlice["has9Slice"] = Boolean::New(env, slice->has9Slice);
+			objSlice["hasPivot"] = Boolean::New(env, slice->hasPivot);
+			objSlice["keys"] = objKeys;
+
+			for (auto &key : slice->keys)
+			{
+				Object objKey = newObject;
+				objKey["frame"] = n_num(key.frame);
+				objKey["x"] = n_num(key.x);
+				objKey["y"] = n_num(key.y);
+				objKey["w"] = n_num(key.w);
+				objKey["h"] = n_num(key.h);
+				obj_push(objKeys, objKey);
+
+				if (slice->has9Slice)
+				{
+					Object obj9Slice = newObject;
+					obj9Slice["x"] = n_num(key.patchX);
+					obj9Slice["y"] = n_num(key.patchY);
+					obj9Slice["w"] = n_num(key.patchW);
+					obj9Slice["h"] = n_num(key.patchH);
+					objKey["patch"] = obj9Slice;
+				}
+				if (slice->hasPivot)
+				{
+					Object objPivot = newObject;
+					objPivot["x"] = n_num(key.pivotX);
+					objPivot["y"] = n_num(key.pivotY);
+					objKey["pivot"] = objPivot;
+				}
+			}
+		}
+		break;
+	}
+
+	return array;
+}
+
+Object AsepriteReader::frameObject(Env env, Document &document, Frame *frame)
+{
+	Object object = findObject(document, frame);
+	if (!object.IsEmpty())
+		return object;
+
+	// frame node object, its cels and tags are built on first access
+	object = newObject;
+	keepObject(document, frame, object);
+	object["duration"] = n_num(frame->duration);
+	object.DefineProperties({
+		PropertyDescriptor::Accessor<getFrameCels>("cels", LAZY_PROPERTY, frame),
+		PropertyDescriptor::Accessor<getFrameTags>("tags", LAZY_PROPERTY, frame),
+		PropertyDescriptor::Value("_document", document.self.Value()),
+	});
+	return object;
+}
+
+Array AsepriteReader::frameCels(Env env, Document &document, Frame *frame)
+{
+	// indexed by layer, with holes for layers without a cel
+	Array objCels = newArray;
+	for (size_t i = 0; i < frame->cels.size(); i++)
+	{
+		if (frame->cels[i])
+			objCels[(uint32_t)i] = celObject(env, document, frame->cels[i]);
+	}
+	return objCels;
+}
+
+Array AsepriteReader::frameTags(Env env, Document &document, Frame *frame)
+{
+	Array objTags = newArray;
+	for (FrameTag *tag : frame->tags)
+		obj_push(objTags, tagObject(env, document, tag));
+	return objTags;
+}
+
+Object AsepriteReader::tagObject(Env env, Document &document, FrameTag *tag)
+{
+	Object object = findObject(document, tag);
+	if (!object.IsEmpty())
+		return object;
+
+	// tag node object
+	object = newObject;
+	keepObject(document, tag, object);
+	Array objFrames = newArray;
+	object["from"] = n_num(tag->frameFrom);
+	object["to"] = n_num(tag->frameTo);
+	object["direction"] = n_num((uint8_t)tag->direction);
+	object["name"] = n_str(tag->name);
+	set_color(object["color"], tag->color);
+	object["frames"] = objFrames;
+
+	for (Frame *frame : tag->frames)
+		obj_push(objFrames, frameObject(env, document, frame));
+	return object;
+}
+
+Object AsepriteReader::tilesetObject(Env env, Document &document, Tileset *tileset)
+{
+	Object object = findObject(document, tileset);
+	if (!object.IsEmpty())
+		return object;
+
+	// tileset node object
+	object = newObject;
+	keepObject(document, tileset, object);
+	object["id"] = n_num(tileset->id);
+	object["name"] = n_str(tileset->name);
+	object["numTiles"] = n_num(tileset->numTiles);
+	object["tileWidth"] = n_num(tileset->tileWidth);
+	object["tileHeight"] = n_num(tileset->tileHeight);
+	object["baseIndex"] = n_num(tileset->baseIndex);
+
+	if (tileset->pixels)
+	{
+		ArrayBuffer buffer = pixelBuffer(env, tileset->pixels, tileset->pixelsLength);
+		object["pixels"] = Uint8Array::New(env, tileset->pixelsLength, buffer, 0);
+		countObjects(2);
+	}
+	return object;
+}
+
+Object AsepriteReader::layerObject(Env env, Document &document, Layer *layer)
+{
+	Object object = findObject(document, layer);
+	if (!object.IsEmpty())
+		return object;
+
+	// layer node object, kept before its parent and children are built as
+	// they refer back to it
+	object = newObject;
+	keepObject(document, layer, object);
+	Array objChildren = newArray;
+	object["name"] = n_str(layer->name);
+	object["index"] = n_num(layer->index);
+	object["type"] = n_num(layer->type);
+	object["flags"] = n_num(layer->flags);
+	object["opacity"] = n_num(layer->opacity);
+	object["blendMode"] = n_num((uint16_t)layer->blendMode);
+	object["children"] = objChildren;
+
+	if (layer->tileset)
+		object["tileset"] = tilesetObject(env, document, layer->tileset);
+
+	if (layer->layerParent)
+		object["layerParent"] = layerObject(env, document, layer->layerParent);
+
+	for (Layer *child : layer->layerChildren)
+		obj_push(objChildren, layerObject(env, document, child));
+	return object;
+}
+
+Object AsepriteReader::celObject(Env env, Document &document, Cel *cel)
+{
+	Object object = findObject(document, cel);
+	if (!object.IsEmpty())
+		return object;
+
+	// cel node object
+	object = newObject;
+	keepObject(document, cel, object);
+	object["x"] = n_num(cel->x);
+	object["y"] = n_num(cel->y);
+	object["w"] = n_num(cel->w);
+	object["h"] = n_num(cel->h);
+	object["opacity"] = n_num(cel->opacity);
+	object["frame"] = frameObject(env, document, cel->frame);
+	object["layer"] = layerObject(env, document, cel->layer);
+
+	if (cel->link >= 0)
+		object["link"] = n_num(cel->link);
+
+	// the hidden reference keeps the document (and the native cel behind
+	// the getters) alive with the cel
+	Object self = document.self.Value();
+
+	if (options.lazy)
+	{
+		object.DefineProperties({
+			PropertyDescriptor::Accessor<GetCelPixels>("pixels", napi_enumerable, cel),
+			PropertyDescriptor::Function<ReleaseCelPixels>("releasePixels", napi_default, cel),
+			PropertyDescriptor::Value("_document", self),
+			PropertyDescriptor::Function<CelToRGBA>("toRGBA", napi_default, cel),
+		});
+		return object;
+	}
+
+	Uint8Array pixels;
+	if (cel->linkedCel || cel->duplicateOf)
+	{
+		// linked and duplicate cels share the pixel array of the cel they
+		// link to, or repeat
+		Value linked = celObject(env, document, cel->linkedCel ? cel->linkedCel : cel->duplicateOf).Get("pixels");
+		if (linked.IsTypedArray())
+			pixels = linked.As<Uint8Array>();
+	}
+	else if (cel->pixels)
+	{
+		ArrayBuffer buffer = pixelBuffer(env, cel->pixels, cel->pixelsLength);
+		pixels = Uint8Array::New(env, cel->pixelsLength, buffer, 0);
+		countObjects(2);
+	}
+
+	// Metadata-only loads have no pixels
+	if (!pixels.IsEmpty())
+	{
+		object["pixels"] = pixels;
+
+		// The same memory seen as tiles
+		if (cel->tilemap)
+		{
+			object["tiles"] = Uint32Array::New(env, cel->pixelsLength / 4, pixels.ArrayBuffer(), pixels.ByteOffset());
+			countObjects(1);
 		}
 	}
+
+	object.DefineProperties({
+		PropertyDescriptor::Value("_document", self),
+		PropertyDescriptor::Function<CelToRGBA>("toRGBA", napi_default, cel),
+	});
+	return object;
 }
+
+// Columns of the compact tables, see index.d.ts
+enum CompactStride
+{
+	COMPACT_LAYER_STRIDE = 6,
+	COMPACT_CEL_STRIDE = 10,
+	COMPACT_TAG_STRIDE = 3,
+	COMPACT_SLICE_KEY_STRIDE = 12,
+	COMPACT_TILESET_STRIDE = 7,
+};
+
+Object AsepriteReader::toCompactObject(Env env)
+{
+	Clock::time_point start;
+	if (options.stats)
+		start = Clock::now();
+	stats.jsObjects = 0;
+
+	Object object = newObject;
+	object["compact"] = Boolean::New(env, true);
+	object["width"] = n_num(file.width);
+	object["height"] = n_num(file.height);
+	object["colorDepth"] = n_num(file.colorDepth);
+	object["pixelFormat"] = n_str(pixelFormatName(file.pixelFormat));
+	object["numFrames"] = n_num(file.numFrames);
+	object["numColors"] = n_num(file.numColors);
+	object["pixelRatio"] = n_num(file.pixelRatio);
+
+	// A plain load has one pixel block, handed over as is. A streamed load
+	// has one per frame, copied end to end.
+	struct Range
+	{
+		const uint8_t *begin;
+		size_t length;
+		size_t offset; // in the output
+	};
+	std::vector<Range> ranges;
+	size_t total = 0;
+	for (const PixelBlock &block : pixelBlocks)
+	{
+		ranges.push_back({block.data.get(), block.length, total});
+		total += block.length;
+	}
+	if (total > INT_MAX)
+		throw ResourceLoadException("Pixels too large for the compact form");
+
+	ArrayBuffer pixels;
+	if (pixelBlocks.size() == 1)
+	{
+		pixels = pixelBuffer(env, pixelBlocks[0].data, pixelBlocks[0].length);
+	}
+	else
+	{
+		pixels = ArrayBuffer::New(env, total);
+		for (const Range &range : ranges)
+			memcpy(static_cast<uint8_t *>(pixels.Data()) + range.offset, range.begin, range.length);
+	}
+	object["pixels"] = Uint8Array::New(env, total, pixels, 0);
+	countObjects(2);
+
+	std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b)
+			  { return a.begin < b.begin; });
+
+	// Offset of pixels in the output, -1 if they are not in a block
+	auto pixelOffset = [&ranges](const std::shared_ptr<uint8_t> &data) -> int32_t
+	{
+		const uint8_t *p = data.get();
+		auto found = std::upper_bound(ranges.begin(), ranges.end(), p, [](const uint8_t *value, const Range &range)
+									  { return value < range.begin; });
+		if (!p || found == ranges.begin())
+			return -1;
+		--found;
+		return p <= found->begin + found->length ? (int32_t)(found->offset + (p - found->begin)) : -1;
+	};
+
+	// Typed arrays count for two objects, with their ArrayBuffer
+	auto int32Table = [&](size_t length)
+	{
+		countObjects(2);
+		return Int32Array::New(env, length);
+	};
+
+	std::map<const Frame *, int> frameIndexes;
+	Uint16Array durations = Uint16Array::New(env, file.frames.size());
+	countObjects(2);
+	for (size_t i = 0; i < file.frames.size(); i++)
+	{
+		frameIndexes[file.frames[i]] = (int)i;
+		durations[i] = (uint16_t)file.frames[i]->duration;
+	}
+	object["frameDurations"] = durations;
+
+	std::map<const Tileset *, int> tilesetIndexes;
+	Int32Array tilesets = int32Table(file.tilesets.size() * COMPACT_TILESET_STRIDE);
+	Array tilesetNames = newArray;
+	for (size_t i = 0; i < file.tilesets.size(); i++)
+	{
+		const Tileset *tileset = file.tilesets[i];
+		int32_t *row = tilesets.Data() + i * COMPACT_TILESET_STRIDE;
+		tilesetIndexes[tileset] = (int)i;
+		row[0] = tileset->id;
+		row[1] = tileset->numTiles;
+		row[2] = tileset->tileWidth;
+		row[3] = tileset->tileHeight;
+		row[4] = tileset->baseIndex;
+		row[5] = pixelOffset(tileset->pixels);
+		row[6] = tileset->pixels ? (int32_t)tileset->pixelsLength : 0;
+		tilesetNames[(uint32_t)i] = n_str(tileset->name);
+	}
+	object["tilesets"] = tilesets;
+	object["tilesetNames"] = tilesetNames;
+
+	Int32Array layers = int32Table(file.layers.size() * COMPACT_LAYER_STRIDE);
+	Array layerNames = newArray;
+	for (size_t i = 0; i < file.layers.size(); i++)
+	{
+		const Layer *layer = file.layers[i];
+		int32_t *row = layers.Data() + i * COMPACT_LAYER_STRIDE;
+		row[0] = layer->type;
+		row[1] = layer->flags;
+		row[2] = layer->opacity;
+		row[3] = (int32_t)layer->blendMode;
+		row[4] = layer->layerParent ? layer->layerParent->index : -1;
+		row[5] = layer->tileset ? tilesetIndexes[layer->tileset] : -1;
+		layerNames[(uint32_t)i] = n_str(layer->name);
+	}
+	object["layers"] = layers;
+	object["layerNames"] = layerNames;
+
+	Int32Array cels = int32Table(file.cels.size() * COMPACT_CEL_STRIDE);
+	for (size_t i = 0; i < file.cels.size(); i++)
+	{
+		const Cel *cel = file.cels[i];
+		int32_t *row = cels.Data() + i * COMPACT_CEL_STRIDE;
+		row[0] = cel->x;
+		row[1] = cel->y;
+		row[2] = cel->w;
+		row[3] = cel->h;
+		row[4] = cel->opacity;
+		row[5] = frameIndexes[cel->frame];
+		row[6] = cel->layer->index;
+		row[7] = cel->link;
+		row[8] = pixelOffset(cel->pixels);
+		row[9] = cel->pixels ? (int32_t)cel->pixelsLength : 0;
+	}
+	object["cels"] = cels;
+
+	Int32Array tags = int32Table(file.tags.size() * COMPACT_TAG_STRIDE);
+	Uint8Array tagColors = Uint8Array::New(env, file.tags.size() * 4);
+	Array tagNames = newArray;
+	countObjects(2);
+	for (size_t i = 0; i < file.tags.size(); i++)
+	{
+		const FrameTag *tag = file.tags[i];
+		int32_t *row = tags.Data() + i * COMPACT_TAG_STRIDE;
+		row[0] = tag->frameFrom;
+		row[1] = tag->frameTo;
+		row[2] = (int32_t)tag->direction;
+		memcpy(tagColors.Data() + i * 4, &tag->color, 4);
+		tagNames[(uint32_t)i] = n_str(tag->name);
+	}
+	object["tags"] = tags;
+	object["tagColors"] = tagColors;
+	object["tagNames"] = tagNames;
+
+	Object palette = newObject;
+	Uint8Array colors = Uint8Array::New(env, file.palette->colors.size() * 4);
+	countObjects(2);
+	if (!file.palette->colors.empty())
+		memcpy(colors.Data(), file.palette->colors.data(), file.palette->colors.size() * 4);
+	palette["size"] = n_num(file.palette->paletteSize);
+	palette["firstColor"] = n_num(file.palette->firstColor);
+	palette["lastColor"] = n_num(file.palette->lastColor);
+	palette["colors"] = colors;
+	object["palette"] = palette;
+
+	size_t keyCount = 0;
+	for (const Slice *slice : file.slices)
+		keyCount += slice->keys.size();
+
+	Array sliceNames = newArray;
+	Uint8Array sliceFlags = Uint8Array::New(env, file.slices.size());
+	Int32Array sliceKeys = int32Table(keyCount * COMPACT_SLICE_KEY_STRIDE);
+	countObjects(2);
+	int32_t *row = sliceKeys.Data();
+	for (size_t i = 0; i < file.slices.size(); i++)
+	{
+		const Slice *slice = file.slices[i];
+		sliceNames[(uint32_t)i] = n_str(slice->name);
+		sliceFlags[i] = (slice->has9Slice ? 1 : 0) | (slice->hasPivot ? 2 : 0);
+
+		for (const SliceKey &key : slice->keys)
+		{
+			const int32_t values[COMPACT_SLICE_KEY_STRIDE] = {
+				(int32_t)i, key.frame, key.x, key.y, key.w, key.h,
+				key.patchX, key.patchY, key.patchW, key.patchH, key.pivotX, key.pivotY};
+			memcpy(row, values, sizeof(values));
+			row += COMPACT_SLICE_KEY_STRIDE;
+		}
+	}
+	object["sliceNames"] = sliceNames;
+	object["sliceFlags"] = sliceFlags;
+	object["sliceKeys"] = sliceKeys;
+
+	if (options.stats)
+		stats.objectSeconds = secondsSince(start);
+
+	return object;
+}
+#endif
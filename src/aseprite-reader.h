@@ -9,45 +9,63 @@
 #define IS_NODE
 
 #include <exception>
+#include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #ifdef IS_NODE
 #include <napi.h>
 #endif
 
+#include "arena.h"
+
+class MappedFile;
+
 class AsepriteReader final
 {
 public:
+	// Values as stored in the file
 	enum class BlendMode
 	{
 		NORMAL = 0,
-
-		DARKEN = 1,
-		MULTIPLY = 2,
-		COLOR_BURN = 3,
-
-		LIGHTEN = 4,
-		SCREEN = 5,
+		MULTIPLY = 1,
+		SCREEN = 2,
+		OVERLAY = 3,
+		DARKEN = 4,
+		LIGHTEN = 5,
 		COLOR_DODGE = 6,
-		ADDITION = 7,
-
-		OVERLAY = 8,
+		COLOR_BURN = 7,
+		HARD_LIGHT = 8,
 		SOFT_LIGHT = 9,
-		HARD_LIGHT = 10,
-
-		DIFFERENCE = 11,
-		EXCLUSION = 12,
-		SUBTRACT = 13,
-		DIVIDE = 14,
+		DIFFERENCE = 10,
+		EXCLUSION = 11,
+		HUE = 12,
+		SATURATION = 13,
+		COLOR = 14,
+		LUMINOSITY = 15,
+		ADDITION = 16,
+		SUBTRACT = 17,
+		DIVIDE = 18,
+	};
 
-		HUE = 15,
-		SATURATION = 16,
-		COLOR = 17,
-		LUMINOSITY = 18,
+	// Bits of Layer::flags
+	enum LayerFlag
+	{
+		LAYER_FLAG_VISIBLE = 1,
+		LAYER_FLAG_BACKGROUND = 8,
+		LAYER_FLAG_REFERENCE = 64,
 	};
 
+	// Tiles of tilemap cels, as laid out by Aseprite: the index in the
+	// tileset in the low bits, then the flips. The diagonal flip (swapping X
+	// and Y) applies before the other two.
+	static const uint32_t TILE_INDEX_MASK = 0x1fffffff;
+	static const uint32_t TILE_FLIP_X = 0x80000000;
+	static const uint32_t TILE_FLIP_Y = 0x40000000;
+	static const uint32_t TILE_FLIP_D = 0x20000000;
+
 	enum class AnimationDirection
 	{
 		FORWARD = 0,
@@ -55,6 +73,18 @@ public:
 		PINGPONG = 2,
 	};
 
+	// Layout of decoded cel and tileset pixels, see LoadOptions::format.
+	// 16 bit formats hold one value per pixel in host byte order.
+	enum class PixelFormat
+	{
+		NATIVE = 0, // as in the file: RGBA8, grayscale + alpha or indexed
+		RGBA8 = 1,
+		BGRA8 = 2,
+		RGBA8_PREMULTIPLIED = 3,
+		RGB565 = 4, // alpha dropped
+		RGBA4444 = 5,
+	};
+
 protected:
 	struct Color
 	{
@@ -83,22 +113,29 @@ public:
 	struct Cel;
 	struct Slice;
 	struct SliceKey;
+	struct Tileset;
 
 	struct AsepriteFile
 	{
 		int width;
 		int height;
 		int numFrames;
-		uint8_t colorDepth;
+		uint8_t colorDepth; // bits per pixel of the decoded pixels
+		PixelFormat pixelFormat = PixelFormat::NATIVE;
 		uint16_t numColors;
+		uint8_t transparentIndex; // indexed sprites only
 		double pixelRatio;
+		bool layerOpacity = false; // layer opacity is set, layers are opaque otherwise
+		bool groupBlending = false; // group opacity and blend mode are set
 		std::unique_ptr<Palette> palette = nullptr;
 
-		std::vector<std::unique_ptr<Frame>> frames;
-		std::vector<std::unique_ptr<FrameTag>> tags;
-		std::vector<std::unique_ptr<Layer>> layers;
-		std::vector<std::unique_ptr<Cel>> cels;
-		std::vector<std::unique_ptr<Slice>> slices;
+		// Records live in arenas and never move, so they point to each other
+		RecordArena<Frame> frames;
+		RecordArena<FrameTag> tags;
+		RecordArena<Layer> layers;
+		RecordArena<Cel> cels;
+		RecordArena<Slice> slices;
+		RecordArena<Tileset> tilesets;
 	};
 
 	struct Frame
@@ -107,12 +144,6 @@ public:
 
 		std::vector<Cel *> cels;
 		std::vector<FrameTag *> tags;
-
-#ifdef IS_NODE
-		Napi::Object object;
-		Napi::Array objCels;
-		Napi::Array objTags;
-#endif
 	};
 
 	struct FrameTag
@@ -126,11 +157,6 @@ public:
 		AnimationDirection direction; // forward, reverse, pingpong
 
 		std::vector<Frame *> frames;
-
-#ifdef IS_NODE
-		Napi::Object object;
-		Napi::Array objFrames;
-#endif
 	};
 
 	struct Palette
@@ -138,12 +164,7 @@ public:
 		int paletteSize = 0;
 		int firstColor = 0;
 		int lastColor = 0;
-		std::vector<std::unique_ptr<Color>> colors;
-
-#ifdef IS_NODE
-		Napi::Object object;
-		Napi::Array objColors;
-#endif
+		std::vector<Color> colors;
 	};
 
 	struct Layer
@@ -159,10 +180,9 @@ public:
 		Layer *layerParent = nullptr;
 		std::vector<Layer *> layerChildren;
 
-#ifdef IS_NODE
-		Napi::Object object;
-		Napi::Array objChildren;
-#endif
+		// Tilemap layers only
+		uint32_t tilesetIndex = 0;
+		Tileset *tileset = nullptr;
 	};
 
 	struct Cel
@@ -174,29 +194,33 @@ public:
 		int opacity = 0;
 		int link = -1;
 
+		// Null until getPixels is called when the file was loaded lazily
 		std::shared_ptr<uint8_t> pixels;
+		size_t pixelsLength = 0; // bytes
+
+		// Tilemap cels count w and h in tiles, and their pixels are w * h
+		// tiles of 32 bits (see TILE_INDEX_MASK) drawn from the layer tileset
+		bool tilemap = false;
+		// Tile bits as stored in the file, turned into the TILE_* layout on decode
+		uint32_t tileMasks[4] = {TILE_INDEX_MASK, TILE_FLIP_X, TILE_FLIP_Y, TILE_FLIP_D};
 
 		Frame *frame = nullptr;
 		Layer *layer = nullptr;
-
-#ifdef IS_NODE
-		Napi::Object object;
-		Napi::Uint8Array objPixels;
-#endif
-	};
-
-	struct Slice
-	{
-		std::string name;
-		bool has9Slice = false;
-		bool hasPivot = false;
-
-		std::vector<std::unique_ptr<SliceKey>> keys;
-
-#ifdef IS_NODE
-		Napi::Object object;
-		Napi::Array objKeys;
-#endif
+		Cel *linkedCel = nullptr;
+		// Unlinked cel with the same pixels, shared with this one (see
+		// LoadOptions::dedup)
+		Cel *duplicateOf = nullptr;
+
+		// Cel data in the input buffer, only set for lazy loads
+		const uint8_t *source = nullptr;
+		uint32_t sourceLength = 0;
+		bool sourceCompressed = false;
+
+		// Returns the pixels, reading them from the source first if needed.
+		// Not thread-safe.
+		std::shared_ptr<uint8_t> getPixels();
+		// Drops the pixels if getPixels can bring them back
+		void releasePixels();
 	};
 
 	struct SliceKey
@@ -216,19 +240,310 @@ public:
 		int pivotY;
 	};
 
+	struct Slice
+	{
+		std::string name;
+		bool has9Slice = false;
+		bool hasPivot = false;
+
+		std::vector<SliceKey> keys;
+	};
+
+
+	struct Tileset
+	{
+		uint32_t id = 0;
+		uint32_t flags = 0;
+		std::string name;
+		uint32_t numTiles = 0;
+		int tileWidth = 0;
+		int tileHeight = 0;
+		int baseIndex = 1; // index of the first tile in Aseprite's UI
+
+		// All tiles stacked vertically, tileWidth x (tileHeight * numTiles),
+		// decoded once and shared by every tilemap cel. Null for metadata
+		// loads and tilesets kept in external files.
+		std::shared_ptr<uint8_t> pixels;
+		size_t pixelsLength = 0; // bytes
+
+		// Tile drawn as nothing at all
+		uint32_t emptyTile() const { return (flags & 4) ? 0 : TILE_INDEX_MASK; }
+	};
+
+	struct LoadOptions
+	{
+		// Threads used to decompress cels, 0 = one per core.
+		// The output is identical whatever the count.
+		unsigned threads = 1;
+		// Leaves cel data in the input buffer until Cel::getPixels is called.
+		// The input must then outlive the reader (loadFile keeps its mapping).
+		bool lazy = false;
+		// Expands indexed and grayscale cels to RGBA while decoding them, and
+		// sets file.colorDepth to 32 once done. Not applied to lazy loads.
+		bool rgba = false;
+		// Converts cels and tilesets to this format while decoding them, and
+		// sets file.pixelFormat and file.colorDepth once done. Tilemap cels
+		// keep their tiles. Not applied to lazy loads.
+		PixelFormat format = PixelFormat::NATIVE;
+		// Makes cels with the same size and pixels share one copy of them,
+		// decoding cels stored twice only once. Not applied to lazy loads.
+		bool dedup = false;
+		// Fills `stats` while loading. Off, it costs one branch per frame.
+		bool stats = false;
+
+		// Selection. Cels outside of it are skipped without being decoded
+		// and left out of the file; frames and layers are all kept. A cel
+		// linked to a skipped cel gets its pixels and loses the link.
+		// Layers by name, a group selecting its children. Empty: all.
+		std::vector<std::string> layers;
+		// Frames of the tags with these names. Empty: all.
+		std::vector<std::string> tags;
+		// Frame range, lastFrame -1 meaning up to the last frame
+		int firstFrame = 0;
+		int lastFrame = -1;
+		// Skips hidden layers (themselves or through a group) and reference layers
+		bool visibleOnly = false;
+
+		// `format`, or RGBA8 for `rgba`
+		PixelFormat outputFormat() const { return format == PixelFormat::NATIVE && rgba ? PixelFormat::RGBA8 : format; }
+		bool selects() const { return !layers.empty() || !tags.empty() || firstFrame > 0 || lastFrame >= 0 || visibleOnly; }
+	};
+
+	struct ChunkStats
+	{
+		uint32_t count = 0;
+		uint64_t bytes = 0; // chunk headers included
+		double seconds = 0; // parsing only, cel data is decoded afterwards
+	};
+
+	struct LoadStats
+	{
+		std::map<uint16_t, ChunkStats> chunks; // by chunk type
+		double loadSeconds = 0;
+		double decodeSeconds = 0; // decompression of cels and tilesets, wall time
+		double objectSeconds = 0; // toObject
+		uint64_t compressedBytes = 0; // compressed cel and tileset data
+		uint64_t decompressedBytes = 0; // what that data inflated to
+		uint64_t nativeBytes = 0; // memoryFootprint() once loaded
+		uint64_t celBytes = 0; // with dedup, pixels of the cels decoded
+		uint64_t dedupBytes = 0; // what dedup saved of celBytes
+		uint32_t dedupCels = 0; // cels sharing the pixels of another
+		uint32_t jsObjects = 0; // objects and arrays made by toObject
+
+		// Name of a chunk type, e.g. "cel", or null if unknown
+		static const char *chunkName(uint16_t type);
+	};
+
 public:
 	AsepriteFile file;
-#ifdef IS_NODE
-	Napi::Object object;
-#endif
+	LoadOptions options;
+	LoadStats stats;
 
 public:
 	AsepriteReader() = default;
 	~AsepriteReader() = default;
 
-#ifdef IS_NODE
-	void load(const uint8_t *in, const uint32_t size, const Napi::CallbackInfo &info);
-#else
+	// Parses the file into `file`. Touches no JS state, so it is safe to call
+	// from a worker thread.
 	void load(const uint8_t *in, const uint32_t size);
+
+	// Same as load, but jumps over cel pixel data instead of reading it.
+	// Cels keep their position, size and link, but have no pixels.
+	void loadMetadata(const uint8_t *in, const uint32_t size);
+
+	// Same as load, reading the file at `path` through a read-only memory
+	// mapping instead of a heap copy. Lazy loads keep the mapping open for as
+	// long as the reader lives.
+	void loadFile(const std::string &path);
+
+	// Where each frame of a file starts, found from the frame headers alone
+	struct FrameIndex
+	{
+		struct Entry
+		{
+			uint32_t offset; // from the start of the file
+			uint32_t size; // bytes, frame header included
+			uint32_t chunkCount;
+			uint16_t duration; // ms
+		};
+
+		uint32_t fileSize = 0;
+		std::vector<Entry> frames;
+
+		// Little endian: "AFIX", version, file size, frame count, then the
+		// offset, size, chunk count and duration of each frame
+		std::vector<uint8_t> serialize() const;
+		// Throws on malformed data
+		static FrameIndex deserialize(const uint8_t *data, size_t size);
+	};
+
+	// Walks the frame headers of a file, jumping over their chunks
+	static FrameIndex buildFrameIndex(const uint8_t *in, const uint32_t size);
+
+	// Same as load, parsing only what frames `first` to `last` need: the
+	// first frame (layers, tags, palette, tilesets and slices), the range
+	// and the frames holding cels linked from it. Other frames keep their
+	// duration but have no cels, and cels outside the range are left out.
+	// The selection in options applies within the range. `index` must
+	// describe the same bytes.
+	void loadFrames(const uint8_t *in, const uint32_t size, const FrameIndex &index, unsigned first, unsigned last);
+	// Same as loadFrames, for the file at `path` mapped as by loadFile.
+	// Builds the index when null.
+	void loadFileFrames(const std::string &path, const FrameIndex *index, unsigned first, unsigned last);
+
+	// Flattens the visible layers of a frame into `out`, which receives
+	// width * height RGBA pixels. Follows layer order and visibility (group
+	// visibility included), cel and layer opacity and layer blend modes.
+	// Groups are flattened on their own then blended with their opacity and
+	// blend mode, when the file sets them (file.groupBlending). Layers are
+	// opaque in files without file.layerOpacity.
+	// Throws for pixel formats other than NATIVE and RGBA8.
+	void renderFrame(unsigned frameIndex, uint8_t *out, bool includeHidden = false);
+
+	// Returns the pixels of `cel` as RGBA: the cel's own pixels if the file
+	// is RGBA, otherwise a new buffer of w * h * 4 bytes expanded through the
+	// palette (or from grayscale). Tilemap cels are drawn tile by tile into
+	// (w * tileWidth) x (h * tileHeight) pixels. Null if the cel has no
+	// pixels. `length` receives the size in bytes. Throws for pixel formats
+	// other than NATIVE and RGBA8.
+	std::shared_ptr<uint8_t> toRGBA(Cel *cel, size_t *length = nullptr);
+
+	// Approximate memory held by the parsed file, pixels included
+	size_t memoryFootprint() const;
+
+	// Name of a pixel format in JS options, e.g. "rgba-premultiplied"
+	static const char *pixelFormatName(PixelFormat format);
+
+#ifdef IS_NODE
+	// Native side of a parsed JS object: the reader, shared as cached readers
+	// back several objects, and the objects built so far for its records.
+	// References are weak; a record whose object was collected gets a new one.
+	struct Document
+	{
+		std::shared_ptr<AsepriteReader> reader;
+		Napi::ObjectReference self;
+		std::unordered_map<const void *, Napi::ObjectReference> objects;
+
+		// Attaches a new document to `object`, which deletes it when collected
+		static void wrap(Napi::Env env, Napi::Object object, std::shared_ptr<AsepriteReader> reader);
+		// The document of an object made by toObject or toCompactObject, or null
+		static Document *unwrap(Napi::Env env, Napi::Value value);
+	};
+
+	// Builds the JS object of a loaded file, to be wrapped by Document::wrap.
+	// Its frames, tags, layers, cels, slices, tilesets and palette, and the
+	// cels and tags of each frame, are getters that build their objects on
+	// first access and then become plain properties. Main thread only.
+	Napi::Object toObject(Napi::Env env);
+
+	// Same data as toObject in a constant number of JS objects: records
+	// become rows of typed arrays, cross references become indexes, and the
+	// pixels of all cels and tilesets are ranges of a single buffer. Needs
+	// the pixels decoded (not lazy). Main thread only.
+	Napi::Object toCompactObject(Napi::Env env);
+
+	// Hands pixels to JS without copying them. The buffer keeps its own
+	// reference, so the pixels stay alive after the reader is gone.
+	static Napi::ArrayBuffer pixelBuffer(Napi::Env env, const std::shared_ptr<uint8_t> &pixels, size_t length);
+#endif
+
+private:
+	// Cel data found by the chunk pass, decoded once the chunks are read
+	struct PendingCel
+	{
+		Cel *cel;
+		const uint8_t *data;
+		uint32_t length;
+		bool compressed;
+	};
+
+	// Compressed tileset image, decoded with the cels
+	struct PendingTileset
+	{
+		Tileset *tileset;
+		const uint8_t *data;
+		uint32_t length;
+	};
+
+	// What loadFrames reads: the frames flagged in `wanted`, keeping the
+	// cels of frames `first` to `last`
+	struct FrameSelection
+	{
+		const FrameIndex &index;
+		std::vector<bool> wanted;
+		unsigned first;
+		unsigned last;
+	};
+
+	// Parsing state carried from one frame to the next
+	struct ParseState
+	{
+		const FrameSelection *frames = nullptr;
+		uint16_t layerIndex = 0;
+		std::map<int, Layer *> layerLevelMap;
+		std::vector<PendingCel> pendingCels;
+		std::vector<Cel *> linkedCels;
+		std::vector<PendingTileset> pendingTilesets;
+
+		// Cels left out by the selection, by frame and layer index, kept
+		// with their source data for the cels linked to them
+		RecordArena<Cel> skippedCels;
+		std::map<std::pair<unsigned, unsigned>, Cel *> skippedCelMap;
+		bool tagsRead = false;
+	};
+
+	// Pixel blocks made by decodeCels, one per load (one per frame when
+	// streaming), in allocation order
+	struct PixelBlock
+	{
+		std::shared_ptr<uint8_t> data;
+		size_t length;
+	};
+
+	std::shared_ptr<MappedFile> mapping;
+
+	// Opens `path` for loadFile and loadFileFrames
+	static std::shared_ptr<MappedFile> mapFile(const std::string &path);
+	std::vector<PixelBlock> pixelBlocks;
+
+	// Reads every frame, or those of `frames`
+	void read(const uint8_t *in, const uint32_t size, bool metadataOnly, const FrameSelection *frames = nullptr);
+	// Reads the 128 bytes file header
+	void readHeader(const uint8_t *in, const uint32_t size);
+	// Reads one frame, `in` starting at its size field and `size` bytes long
+	void readFrame(const uint8_t *in, const uint32_t size, ParseState &state, bool metadataOnly);
+	// The chunks of readFrame, measured into `stats` when `Stats` is set
+	template <bool Stats>
+	void readChunks(const uint8_t *in, const uint32_t size, ParseState &state, bool metadataOnly);
+	// Decodes the tilesets and cels queued by readFrame, the cels into one
+	// pixel block
+	void decodeCels(ParseState &state);
+	// Points decoded cels with the same pixels as an earlier one at its
+	// copy, then moves the rest into a smaller block
+	void shareDuplicates(ParseState &state);
+	// Links tags and frames once every frame is read
+	void linkTags();
+	// Describes the pixels decodeCels converted, once every frame is read
+	void setPixelFormat();
+	// Whether the cel of `layer` in frame `frameIndex` is in options' selection
+	bool celSelected(const ParseState &state, unsigned frameIndex, const Layer *layer) const;
+
+#ifdef IS_NODE
+	// Objects of single records for toObject, one per record and document
+	Napi::Object frameObject(Napi::Env env, Document &document, Frame *frame);
+	Napi::Object tagObject(Napi::Env env, Document &document, FrameTag *tag);
+	Napi::Object layerObject(Napi::Env env, Document &document, Layer *layer);
+	Napi::Object celObject(Napi::Env env, Document &document, Cel *cel);
+	Napi::Object tilesetObject(Napi::Env env, Document &document, Tileset *tileset);
+	// Values of the toObject getters
+	Napi::Value documentProperty(Napi::Env env, Document &document, int property);
+	Napi::Array frameCels(Napi::Env env, Document &document, Frame *frame);
+	Napi::Array frameTags(Napi::Env env, Document &document, Frame *frame);
+
+	static Napi::Value getDocumentProperty(const Napi::CallbackInfo &info);
+	static Napi::Value getFrameCels(const Napi::CallbackInfo &info);
+	static Napi::Value getFrameTags(const Napi::CallbackInfo &info);
 #endif
+
+	friend class AsepriteStreamParser;
 };
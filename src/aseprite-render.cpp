@@ -0,0 +1,184 @@
+/*
+ * aseprite-render.cpp
+ *
+ *  Frame compositing: flattens the cels of a frame into one RGBA image.
+ */
+
+#include "aseprite-reader.h"
+#include "aseprite-blend.h"
+#include "aseprite-convert.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Reference layers are never exported
+static bool isLayerShown(const AsepriteReader::Layer *layer)
+{
+	return (layer->flags & AsepriteReader::LAYER_FLAG_VISIBLE) && !(layer->flags & AsepriteReader::LAYER_FLAG_REFERENCE);
+}
+
+// Draws a tilemap cel tile by tile, straight from the layer tileset, so the
+// map is never expanded to a full image
+static void drawTilemap(const AsepriteReader::AsepriteFile &file, const AsepriteReader::Cel *cel, const uint32_t *tiles, int opacity, const uint32_t lut[256], uint8_t *out)
+{
+	const AsepriteReader::Layer *layer = cel->layer;
+	const AsepriteReader::Tileset &tileset = *layer->tileset;
+	const int tileW = tileset.tileWidth;
+	const int tileH = tileset.tileHeight;
+	const uint32_t empty = tileset.emptyTile();
+
+	std::vector<uint8_t> row((size_t)tileW * 4);
+
+	for (int ty = 0; ty < cel->h; ty++)
+	{
+		const int top = cel->y + ty * tileH;
+		const int y0 = std::max(top, 0);
+		const int y1 = std::min(top + tileH, file.height);
+
+		if (y0 >= y1)
+			continue;
+
+		for (int tx = 0; tx < cel->w; tx++)
+		{
+			const uint32_t tile = tiles[(size_t)ty * cel->w + tx];
+			const int left = cel->x + tx * tileW;
+			const int x0 = std::max(left, 0);
+			const int x1 = std::min(left + tileW, file.width);
+
+			if ((tile & AsepriteReader::TILE_INDEX_MASK) == empty || x0 >= x1)
+				continue;
+
+			for (int y = y0; y < y1; y++)
+			{
+				tileRowToRGBA(file.colorDepth, row.data(), tileset, tile, y - top, lut);
+				blendRow(layer->blendMode, out + ((size_t)y * file.width + x0) * 4, row.data() + (x0 - left) * 4, x1 - x0, opacity);
+			}
+		}
+	}
+}
+
+// Aseprite ignores the opacity of layers in files not flagged to store it
+static int layerOpacity(const AsepriteReader::AsepriteFile &file, const AsepriteReader::Layer *layer)
+{
+	return file.layerOpacity ? layer->opacity : 255;
+}
+
+// Shared by the layers drawn for one frame
+struct RenderState
+{
+	const AsepriteReader::AsepriteFile &file;
+	const AsepriteReader::Frame *frame;
+	bool includeHidden;
+	uint32_t luts[2][256];
+	std::vector<uint8_t> row;
+};
+
+static void drawCel(RenderState &state, const AsepriteReader::Layer *layer, uint8_t *out)
+{
+	const AsepriteReader::AsepriteFile &file = state.file;
+	AsepriteReader::Cel *cel = layer->index < state.frame->cels.size() ? state.frame->cels[layer->index] : nullptr;
+	if (!cel)
+		return;
+
+	std::shared_ptr<uint8_t> pixels = cel->getPixels();
+	if (!pixels)
+		return;
+
+	const int opacity = mulUn8(cel->opacity, layerOpacity(file, layer));
+	const int bytesPerPixel = file.colorDepth / 8;
+
+	// Tilemap layers are never background layers
+	if (cel->tilemap)
+	{
+		if (layer->tileset && opacity)
+			drawTilemap(file, cel, reinterpret_cast<const uint32_t *>(pixels.get()), opacity, state.luts[0], out);
+		return;
+	}
+
+	const int x0 = std::max(cel->x, 0);
+	const int y0 = std::max(cel->y, 0);
+	const int x1 = std::min(cel->x + cel->w, file.width);
+	const int y1 = std::min(cel->y + cel->h, file.height);
+
+	if (x0 >= x1 || y0 >= y1 || !opacity)
+		return;
+
+	for (int y = y0; y < y1; y++)
+	{
+		const uint8_t *src = pixels.get() + ((size_t)(y - cel->y) * cel->w + (x0 - cel->x)) * bytesPerPixel;
+		uint8_t *dst = out + ((size_t)y * file.width + x0) * 4;
+
+		if (bytesPerPixel != 4)
+		{
+			const bool background = (layer->flags & AsepriteReader::LAYER_FLAG_BACKGROUND) != 0;
+			convertToRGBA(file.colorDepth, state.row.data(), src, x1 - x0, state.luts[background]);
+			src = state.row.data();
+		}
+
+		blendRow(layer->blendMode, dst, src, x1 - x0, opacity);
+	}
+}
+
+// Groups are flattened into an image of their own, which is then blended
+// with the group opacity and blend mode, as Aseprite does
+static void drawLayer(RenderState &state, const AsepriteReader::Layer *layer, uint8_t *out)
+{
+	if (!state.includeHidden && !isLayerShown(layer))
+		return;
+
+	if (layer->layerChildren.empty())
+	{
+		drawCel(state, layer, out);
+		return;
+	}
+
+	// Files saved before groups had an opacity leave it at 0
+	const AsepriteReader::AsepriteFile &file = state.file;
+	if (!file.groupBlending)
+	{
+		for (const AsepriteReader::Layer *child : layer->layerChildren)
+			drawLayer(state, child, out);
+		return;
+	}
+
+	const int opacity = layerOpacity(file, layer);
+	if (!opacity)
+		return;
+
+	std::vector<uint8_t> group((size_t)file.width * file.height * 4, 0);
+	for (const AsepriteReader::Layer *child : layer->layerChildren)
+		drawLayer(state, child, group.data());
+
+	for (int y = 0; y < file.height; y++)
+	{
+		const size_t offset = (size_t)y * file.width * 4;
+		blendRow(layer->blendMode, out + offset, group.data() + offset, file.width, opacity);
+	}
+}
+
+void AsepriteReader::renderFrame(unsigned frameIndex, uint8_t *out, bool includeHidden)
+{
+	if (frameIndex >= file.frames.size())
+		throw ResourceLoadException("Frame index out of range");
+	if (file.pixelFormat != PixelFormat::NATIVE && file.pixelFormat != PixelFormat::RGBA8)
+		throw ResourceLoadException("Frames can only be rendered from native or RGBA pixels");
+
+	RenderState state{file, file.frames[frameIndex], includeHidden, {}, std::vector<uint8_t>(file.colorDepth == 32 ? 0 : (size_t)file.width * 4)};
+
+	memset(out, 0, (size_t)file.width * file.height * 4);
+
+	// Background layers ignore the transparent index, so they get their own table
+	if (file.colorDepth == 8)
+	{
+		buildPaletteLUT(file, false, state.luts[0]);
+		buildPaletteLUT(file, true, state.luts[1]);
+	}
+
+	// Layers are stored bottom to top, children after their group
+	for (const Layer *layer : file.layers)
+	{
+		if (!layer->layerParent)
+			drawLayer(state, layer, out);
+	}
+}
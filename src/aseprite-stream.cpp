@@ -0,0 +1,147 @@
+/*
+ * aseprite-stream.cpp
+ */
+
+#include "aseprite-stream.h"
+
+#include <algorithm>
+#include <chrono>
+
+static const uint32_t HEADER_SIZE = 128;
+static const uint32_t FRAME_HEADER_SIZE = 16;
+
+AsepriteStreamParser::AsepriteStreamParser(const AsepriteReader::LoadOptions &options)
+	: parsed(new AsepriteReader())
+{
+	parsed->options = options;
+	parsed->options.lazy = false;
+	// Each frame is decoded into a block of its own, as it arrives
+	parsed->options.dedup = false;
+
+	// Skipped cels would keep pointers into chunks for later links
+	parsed->options.layers.clear();
+	parsed->options.tags.clear();
+	parsed->options.firstFrame = 0;
+	parsed->options.lastFrame = -1;
+	parsed->options.visibleOnly = false;
+}
+
+uint32_t AsepriteStreamParser::unitLength(const uint8_t *data, size_t available) const
+{
+	if (stage == Stage::HEADER)
+		return HEADER_SIZE;
+	if (available < 4)
+		return 0;
+
+	const uint32_t length = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+	if (length < FRAME_HEADER_SIZE)
+		throw AsepriteReader::ResourceLoadException("Invalid frame size");
+	return length;
+}
+
+void AsepriteStreamParser::write(const uint8_t *data, size_t length)
+{
+	if (!parsed)
+		throw AsepriteReader::ResourceLoadException("Parser was released");
+
+	while (length && stage != Stage::DONE)
+	{
+		// Whole units are parsed straight from the chunk
+		if (pending.empty())
+		{
+			const uint32_t unit = unitLength(data, length);
+			if (unit && unit <= length)
+			{
+				parseUnit(data, unit);
+				data += unit;
+				length -= unit;
+				continue;
+			}
+		}
+
+		// Otherwise the unit is buffered until complete, its size field first
+		const uint32_t unit = unitLength(pending.data(), pending.size());
+		const size_t target = unit ? unit : 4;
+		const size_t take = std::min(length, target - pending.size());
+
+		pending.insert(pending.end(), data, data + take);
+		data += take;
+		length -= take;
+
+		if (unit && pending.size() == unit)
+		{
+			parseUnit(pending.data(), unit);
+			pending.clear();
+		}
+	}
+
+	// Like load, bytes after the last frame are ignored
+}
+
+void AsepriteStreamParser::parseUnit(const uint8_t *data, uint32_t length)
+{
+	AsepriteReader::AsepriteFile &file = parsed->file;
+
+	// Stats add up the time spent parsing, not the time between writes
+	std::chrono::steady_clock::time_point start;
+	if (parsed->options.stats)
+		start = std::chrono::steady_clock::now();
+
+	if (stage == Stage::HEADER)
+	{
+		parsed->readHeader(data, length);
+		stage = file.numFrames ? Stage::FRAME : Stage::DONE;
+
+		if (parsed->options.stats)
+			parsed->stats.loadSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (onHeader)
+			onHeader(file);
+		return;
+	}
+
+	const size_t layersBefore = file.layers.size();
+	const size_t celsBefore = file.cels.size();
+
+	// Cels point into `data`, so they are decoded before it goes away
+	parsed->readFrame(data, length, state, false);
+	parsed->decodeCels(state);
+
+	if (parsed->options.stats)
+		parsed->stats.loadSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (onLayer)
+	{
+		for (size_t i = layersBefore; i < file.layers.size(); i++)
+			onLayer(file.layers[i]);
+	}
+	if (onCel)
+	{
+		for (size_t i = celsBefore; i < file.cels.size(); i++)
+			onCel(file.cels[i]);
+	}
+	if (onFrame)
+		onFrame(file.frames.back(), framesRead);
+
+	if (++framesRead == (unsigned)file.numFrames)
+		stage = Stage::DONE;
+}
+
+void AsepriteStreamParser::end()
+{
+	if (!parsed)
+		throw AsepriteReader::ResourceLoadException("Parser was released");
+	if (stage != Stage::DONE)
+		throw AsepriteReader::ResourceLoadException("Unexpected EOF");
+
+	if (!ended)
+	{
+		parsed->linkTags();
+
+		// Cels were converted frame by frame, see LoadOptions::format
+		parsed->setPixelFormat();
+		if (parsed->options.stats)
+			parsed->stats.nativeBytes = parsed->memoryFootprint();
+	}
+	ended = true;
+}
@@ -0,0 +1,65 @@
+/*
+ * aseprite-stream.h
+ *
+ *  Push parser: takes the file in chunks of any size and reports the
+ *  header, layers, cels and frames as soon as each one is complete. Only
+ *  the current frame is buffered, using the size field of each frame.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include "aseprite-reader.h"
+
+class AsepriteStreamParser final
+{
+public:
+	// Called once each item is complete. Layers and cels of a frame come
+	// before the frame itself. Items stay owned by the reader. Cel pixels
+	// are in options.outputFormat() already, while file.pixelFormat and
+	// file.colorDepth only describe it from end() on.
+	std::function<void(const AsepriteReader::AsepriteFile &)> onHeader;
+	std::function<void(AsepriteReader::Layer *)> onLayer;
+	std::function<void(AsepriteReader::Cel *)> onCel;
+	std::function<void(AsepriteReader::Frame *, unsigned index)> onFrame;
+
+	// `options.lazy`, `options.dedup` and the selection are ignored, chunks
+	// do not outlive write()
+	explicit AsepriteStreamParser(const AsepriteReader::LoadOptions &options = AsepriteReader::LoadOptions());
+
+	// Parses the next bytes of the file. Throws on malformed data.
+	void write(const uint8_t *data, size_t length);
+
+	// Checks that the whole file was written and links tags to frames.
+	// Throws if the file is incomplete.
+	void end();
+
+	bool done() const { return stage == Stage::DONE; }
+
+	// The file parsed so far
+	AsepriteReader &reader() { return *parsed; }
+
+	// Hands the reader over, e.g. once end() returned
+	std::unique_ptr<AsepriteReader> release() { return std::move(parsed); }
+
+private:
+	enum class Stage
+	{
+		HEADER,
+		FRAME,
+		DONE,
+	};
+
+	std::unique_ptr<AsepriteReader> parsed;
+	AsepriteReader::ParseState state;
+	Stage stage = Stage::HEADER;
+	unsigned framesRead = 0;
+	bool ended = false;
+	std::vector<uint8_t> pending; // current, incomplete header or frame
+
+	// Length of the header or frame starting at `data`, 0 if not known yet
+	uint32_t unitLength(const uint8_t *data, size_t available) const;
+	void parseUnit(const uint8_t *data, uint32_t length);
+};
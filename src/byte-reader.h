@@ -0,0 +1,106 @@
+/*
+ * byte-reader.h
+ *
+ *  Little endian cursor over a byte range. Bounds are checked before
+ *  reading, never after: require() checks a run of fixed size fields once,
+ *  then the unchecked reads load them with memcpy. sub() hands out a
+ *  cursor over the next bytes only, e.g. a chunk body, so reads within it
+ *  cannot reach past its declared size.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+class ByteReader final
+{
+public:
+	ByteReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+	size_t position() const { return ptr; }
+	size_t remaining() const { return size - ptr; }
+	const uint8_t *current() const { return data + ptr; }
+
+	// Throws unless `count` more bytes can be read
+	void require(size_t count) const
+	{
+		if (count > size - ptr)
+			throw std::out_of_range("Unexpected EOF");
+	}
+
+	// Unchecked reads, for bytes covered by a previous require()
+	uint8_t u8() { return data[ptr++]; }
+	int16_t i16() { return (int16_t)load<uint16_t>(); }
+	uint16_t u16() { return load<uint16_t>(); }
+	uint32_t u32() { return load<uint32_t>(); }
+	int32_t i32() { return (int32_t)load<uint32_t>(); }
+
+	// Checked
+	void skip(size_t count)
+	{
+		require(count);
+		ptr += count;
+	}
+
+	std::string string(size_t length)
+	{
+		require(length);
+		std::string value(reinterpret_cast<const char *>(data + ptr), length);
+		ptr += length;
+		return value;
+	}
+
+	// A cursor over the next `length` bytes, which this one moves past
+	ByteReader sub(size_t length)
+	{
+		require(length);
+		ByteReader reader(data + ptr, length);
+		ptr += length;
+		return reader;
+	}
+
+	// Reads at `offset` from the start, without moving. Checked.
+	uint16_t peekU16(size_t offset) const { return peek<uint16_t>(offset); }
+	uint32_t peekU32(size_t offset) const { return peek<uint32_t>(offset); }
+
+private:
+	const uint8_t *data;
+	size_t size;
+	size_t ptr = 0;
+
+	template <typename T>
+	T load()
+	{
+		T value;
+		memcpy(&value, data + ptr, sizeof(T));
+		ptr += sizeof(T);
+		return fromLittleEndian(value);
+	}
+
+	template <typename T>
+	T peek(size_t offset) const
+	{
+		if (offset > size || sizeof(T) > size - offset)
+			throw std::out_of_range("Unexpected EOF");
+		T value;
+		memcpy(&value, data + offset, sizeof(T));
+		return fromLittleEndian(value);
+	}
+
+	template <typename T>
+	static T fromLittleEndian(T value)
+	{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		T swapped = 0;
+		for (size_t i = 0; i < sizeof(T); i++)
+			swapped = (T)((swapped << 8) | ((value >> (i * 8)) & 0xff));
+		return swapped;
+#else
+		return value;
+#endif
+	}
+};
@@ -0,0 +1,49 @@
+/*
+ * cpu-features.h
+ *
+ *  Instruction sets the SIMD kernels can count on at compile time, and the
+ *  runtime check that guards the AVX2 ones.
+ *
+ *  AVX2 kernels are built in their own files with -mavx2 and only enabled
+ *  when ASEPRITE_AVX2 is defined, see binding.gyp.
+ */
+
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ASEPRITE_X86
+#endif
+
+#if defined(ASEPRITE_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define ASEPRITE_SSE2
+#endif
+
+#if defined(ASEPRITE_X86) && defined(ASEPRITE_AVX2)
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+inline bool cpuHasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
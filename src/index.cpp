@@ -1,8 +1,340 @@
 #include <napi.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include "aseprite-reader.h"
+#include "aseprite-atlas.h"
+#include "aseprite-convert.h"
+#include "aseprite-stream.h"
+#include "mapped-file.h"
+#include "parse-cache.h"
+#include "parallel.h"
 
 using namespace Napi;
 
+// A name or an array of names
+static std::vector<std::string> ReadNames(Value value)
+{
+	std::vector<std::string> names;
+	if (value.IsString())
+		names.push_back(value.As<String>().Utf8Value());
+
+	if (value.IsArray())
+	{
+		Array array = value.As<Array>();
+		for (uint32_t i = 0; i < array.Length(); i++)
+		{
+			Value name = array.Get(i);
+			if (name.IsString())
+				names.push_back(name.As<String>().Utf8Value());
+		}
+	}
+	return names;
+}
+
+// `compact` only shapes the JS result, it is not a load option. Compact
+// results need decoded pixels, so they turn `lazy` off.
+static void ReadOptions(Object object, AsepriteReader::LoadOptions &options, bool *compact = nullptr)
+{
+	Value threads = object.Get("threads");
+	if (threads.IsNumber())
+		options.threads = threads.As<Number>().Uint32Value();
+
+	options.lazy = object.Get("lazy").ToBoolean().Value();
+	options.rgba = object.Get("rgba").ToBoolean().Value();
+
+	// By name, see AsepriteReader::pixelFormatName. Unknown names are ignored.
+	Value format = object.Get("format");
+	if (format.IsString())
+	{
+		const std::string name = format.As<String>().Utf8Value();
+		for (int i = 0; AsepriteReader::pixelFormatName((AsepriteReader::PixelFormat)i); i++)
+		{
+			if (name == AsepriteReader::pixelFormatName((AsepriteReader::PixelFormat)i))
+				options.format = (AsepriteReader::PixelFormat)i;
+		}
+	}
+	options.stats = object.Get("stats").ToBoolean().Value();
+	options.dedup = object.Get("dedup").ToBoolean().Value();
+
+	// Selection: frames is [first, last], last included
+	options.layers = ReadNames(object.Get("layers"));
+	options.tags = ReadNames(object.Get("tags"));
+	options.visibleOnly = object.Get("visibleOnly").ToBoolean().Value();
+
+	Value frames = object.Get("frames");
+	if (frames.IsArray())
+	{
+		Value first = frames.As<Array>().Get(0u);
+		Value last = frames.As<Array>().Get(1u);
+		if (first.IsNumber())
+			options.firstFrame = std::max(0, first.As<Number>().Int32Value());
+		if (last.IsNumber())
+			options.lastFrame = std::max(-1, last.As<Number>().Int32Value());
+	}
+
+	if (compact)
+	{
+		*compact = object.Get("compact").ToBoolean().Value();
+		if (*compact)
+			options.lazy = false;
+	}
+}
+
+// Reads the optional options object that follows the buffer argument
+static void ReadOptions(const CallbackInfo &info, AsepriteReader::LoadOptions &options, bool *compact = nullptr)
+{
+	if (info.Length() > 1 && info[1].IsObject())
+		ReadOptions(info[1].As<Object>(), options, compact);
+}
+
+// Parsed objects hold a document, which shares the reader as cached readers
+// back several of them
+static AsepriteReader *UnwrapReader(Env env, Value value)
+{
+	AsepriteReader::Document *document = AsepriteReader::Document::unwrap(env, value);
+	return document ? document->reader.get() : nullptr;
+}
+
+// Loads a buffer (or the file at `path` when set) through the parse cache of
+// the environment, if enabled. Safe on worker threads: the cache locks.
+static std::shared_ptr<AsepriteReader> LoadReader(ParseCache *cache, const AsepriteReader::LoadOptions &options, const uint8_t *data, size_t size, const std::string *path)
+{
+	uint64_t key = 0;
+	bool cached = cache && cache->enabled() && ParseCache::cacheable(options);
+
+	if (cached && path)
+		cached = ParseCache::fileKey(*path, options, key);
+	else if (cached)
+		key = ParseCache::bufferKey(data, size, options);
+
+	if (cached)
+	{
+		std::shared_ptr<AsepriteReader> hit = cache->find(key);
+		if (hit)
+			return hit;
+	}
+
+	std::shared_ptr<AsepriteReader> reader = std::make_shared<AsepriteReader>();
+	reader->options = options;
+
+	if (path)
+		reader->loadFile(*path);
+	else
+		reader->load(data, size);
+
+	if (cached)
+		cache->insert(key, reader);
+	return reader;
+}
+
+// ase.renderFrame(frameIndex, { target?, includeHidden? })
+static Value RenderFrame(const CallbackInfo &info)
+{
+	Env env = info.Env();
+	AsepriteReader *reader = UnwrapReader(env, info.This());
+
+	if (!reader)
+	{
+		TypeError::New(env, "renderFrame must be called on a parsed Aseprite object").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+	if (!info.Length() || !info[0].IsNumber())
+	{
+		TypeError::New(env, "Expected a frame index").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	const size_t length = (size_t)reader->file.width * reader->file.height * 4;
+	bool includeHidden = false;
+	Uint8Array target;
+
+	if (info.Length() > 1 && info[1].IsObject())
+	{
+		Object options = info[1].As<Object>();
+		includeHidden = options.Get("includeHidden").ToBoolean().Value();
+
+		Value targetValue = options.Get("target");
+		if (targetValue.IsTypedArray())
+		{
+			// Uint8ClampedArray is accepted too, for canvas ImageData
+			napi_typedarray_type type = targetValue.As<TypedArray>().TypedArrayType();
+			if (type == napi_uint8_array || type == napi_uint8_clamped_array)
+				target = targetValue.As<Uint8Array>();
+		}
+	}
+
+	if (target.IsEmpty())
+	{
+		target = Uint8Array::New(env, length);
+	}
+	else if (target.ByteLength() < length)
+	{
+		RangeError::New(env, "Target must hold width * height * 4 bytes").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	try
+	{
+		reader->renderFrame(info[0].As<Number>().Uint32Value(), target.Data(), includeHidden);
+	}
+	catch (const std::exception &e)
+	{
+		Error::New(env, e.what()).ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	return target;
+}
+
+// ase.stats, times in milliseconds
+static Object LoadStatsObject(Env env, const AsepriteReader::LoadStats &stats)
+{
+	Object object = Object::New(env);
+	object["loadMs"] = Number::New(env, stats.loadSeconds * 1e3);
+	object["decodeMs"] = Number::New(env, stats.decodeSeconds * 1e3);
+	object["objectMs"] = Number::New(env, stats.objectSeconds * 1e3);
+	object["compressedBytes"] = Number::New(env, (double)stats.compressedBytes);
+	object["decompressedBytes"] = Number::New(env, (double)stats.decompressedBytes);
+	object["compressionRatio"] = Number::New(env, stats.compressedBytes ? (double)stats.decompressedBytes / stats.compressedBytes : 0);
+	object["nativeBytes"] = Number::New(env, (double)stats.nativeBytes);
+	object["celBytes"] = Number::New(env, (double)stats.celBytes);
+	object["dedupBytes"] = Number::New(env, (double)stats.dedupBytes);
+	object["dedupCels"] = Number::New(env, stats.dedupCels);
+	object["dedupRatio"] = Number::New(env, stats.celBytes ? (double)stats.celBytes / (stats.celBytes - stats.dedupBytes) : 0);
+	object["jsObjects"] = Number::New(env, stats.jsObjects);
+
+	// Unknown chunk types are listed by their hex value
+	Object chunks = Object::New(env);
+	for (const auto &entry : stats.chunks)
+	{
+		char hex[8];
+		const char *name = AsepriteReader::LoadStats::chunkName(entry.first);
+		if (!name)
+		{
+			snprintf(hex, sizeof(hex), "0x%04x", entry.first);
+			name = hex;
+		}
+
+		Object chunk = Object::New(env);
+		chunk["count"] = Number::New(env, entry.second.count);
+		chunk["bytes"] = Number::New(env, (double)entry.second.bytes);
+		chunk["ms"] = Number::New(env, entry.second.seconds * 1e3);
+		chunks[name] = chunk;
+	}
+	object["chunks"] = chunks;
+
+	return object;
+}
+
+// Builds the JS object for a loaded reader. The object keeps a reference to
+// the reader, which backs its methods, its getters and lazily loaded cels.
+// Lazy cels also read from the input buffer later on, so it is kept alive
+// with a hidden reference (files loaded by path keep their mapping in the
+// reader instead). On failure a JS exception is pending and the object is
+// empty.
+static Object ToObject(Env env, std::shared_ptr<AsepriteReader> reader, Uint8Array buffer, bool compact = false)
+{
+	Object object;
+	try
+	{
+		object = compact ? reader->toCompactObject(env) : reader->toObject(env);
+	}
+	catch (const std::exception &e)
+	{
+		Error::New(env, e.what()).ThrowAsJavaScriptException();
+		return Object();
+	}
+
+	if (reader->options.lazy && !buffer.IsEmpty())
+		object.DefineProperty(PropertyDescriptor::Value("_source", buffer));
+
+	object.DefineProperty(PropertyDescriptor::Function<RenderFrame>("renderFrame"));
+
+	if (reader->options.stats)
+		object["stats"] = LoadStatsObject(env, reader->stats);
+
+	AsepriteReader::Document::wrap(env, object, std::move(reader));
+	return object;
+}
+
+// Parses the buffer (or maps and parses the file) on the libuv threadpool and
+// builds the JS objects back on the main thread once parsing is done.
+class ReadFileWorker : public AsyncWorker
+{
+public:
+	ReadFileWorker(Napi::Env env, Uint8Array buffer, const AsepriteReader::LoadOptions &options, bool compact)
+		: AsyncWorker(env, "AsepriteReader"),
+		  deferred(Promise::Deferred::New(env)),
+		  buffer(Persistent(buffer)),
+		  data(buffer.Data()),
+		  size(buffer.ByteLength()),
+		  options(options),
+		  compact(compact),
+		  cache(env.GetInstanceData<ParseCache>())
+	{
+	}
+
+	ReadFileWorker(Napi::Env env, const std::string &path, const AsepriteReader::LoadOptions &options, bool compact)
+		: AsyncWorker(env, "AsepriteReader"),
+		  deferred(Promise::Deferred::New(env)),
+		  path(path),
+		  fromPath(true),
+		  options(options),
+		  compact(compact),
+		  cache(env.GetInstanceData<ParseCache>())
+	{
+	}
+
+	Promise GetPromise() { return deferred.Promise(); }
+
+protected:
+	void Execute() override
+	{
+		try
+		{
+			reader = LoadReader(cache, options, data, size, fromPath ? &path : nullptr);
+		}
+		catch (const std::exception &e)
+		{
+			SetError(e.what());
+		}
+	}
+
+	void OnOK() override
+	{
+		Napi::Env env = Env();
+		Object object = ToObject(env, reader, fromPath ? Uint8Array() : buffer.Value(), compact);
+
+		if (env.IsExceptionPending())
+			deferred.Reject(env.GetAndClearPendingException().Value());
+		else
+			deferred.Resolve(object);
+	}
+
+	void OnError(const Error &e) override
+	{
+		deferred.Reject(e.Value());
+	}
+
+private:
+	Promise::Deferred deferred;
+	// Keeps the input alive while the worker reads from it
+	Reference<Uint8Array> buffer;
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+	std::string path;
+	bool fromPath = false;
+	AsepriteReader::LoadOptions options;
+	bool compact;
+	ParseCache *cache;
+	std::shared_ptr<AsepriteReader> reader;
+};
+
 Object ReadFile(const CallbackInfo &info)
 {
 	Env env = info.Env();
@@ -15,11 +347,93 @@ Object ReadFile(const CallbackInfo &info)
 	}
 
 	Uint8Array buffer = info[0].As<Uint8Array>();
-	AsepriteReader reader;
+	AsepriteReader::LoadOptions options;
+	bool compact = false;
+	ReadOptions(info, options, &compact);
+	std::shared_ptr<AsepriteReader> reader;
+
+	try
+	{
+		reader = LoadReader(env.GetInstanceData<ParseCache>(), options, buffer.Data(), buffer.ByteLength(), nullptr);
+	}
+	catch (const std::exception &e)
+	{
+		Error::New(env, e.what()).ThrowAsJavaScriptException();
+		return EMPTY;
+	}
+
+	return ToObject(env, reader, buffer, compact);
+}
+
+Object ReadInfo(const CallbackInfo &info)
+{
+	Env env = info.Env();
+	Object EMPTY = Object::New(env);
+
+	if (!info.Length() || !info[0].IsTypedArray())
+	{
+		Error::New(env, "Expected one Uint8Array argument").ThrowAsJavaScriptException();
+		return EMPTY;
+	}
+
+	Uint8Array buffer = info[0].As<Uint8Array>();
+	std::shared_ptr<AsepriteReader> reader = std::make_shared<AsepriteReader>();
+
+	try
+	{
+		reader->loadMetadata(buffer.Data(), buffer.ByteLength());
+	}
+	catch (const std::exception &e)
+	{
+		Error::New(env, e.what()).ThrowAsJavaScriptException();
+		return EMPTY;
+	}
+
+	// The getters of the result read from the reader, which it keeps
+	return ToObject(env, reader, Uint8Array());
+}
+
+Value ReadFileAsync(const CallbackInfo &info)
+{
+	Env env = info.Env();
+
+	if (!info.Length() || !info[0].IsTypedArray())
+	{
+		Promise::Deferred deferred = Promise::Deferred::New(env);
+		deferred.Reject(TypeError::New(env, "Expected one Uint8Array argument").Value());
+		return deferred.Promise();
+	}
+
+	AsepriteReader::LoadOptions options;
+	bool compact = false;
+	ReadOptions(info, options, &compact);
+
+	ReadFileWorker *worker = new ReadFileWorker(env, info[0].As<Uint8Array>(), options, compact);
+	Promise promise = worker->GetPromise();
+	worker->Queue();
+	return promise;
+}
+
+Object ReadPath(const CallbackInfo &info)
+{
+	Env env = info.Env();
+	Object EMPTY = Object::New(env);
+
+	if (!info.Length() || !info[0].IsString())
+	{
+		TypeError::New(env, "Expected a file path").ThrowAsJavaScriptException();
+		return EMPTY;
+	}
+
+	const std::string path = info[0].As<String>().Utf8Value();
+	AsepriteReader::LoadOptions options;
+	bool compact = false;
+	ReadOptions(info, options, &compact);
+	std::shared_ptr<AsepriteReader> reader;
 
 	try
 	{
-		reader.load(buffer.Data(), buffer.ByteLength(), info);
+		reader = LoadReader(env.GetInstanceData<ParseCache>(), options, nullptr, 0, &path);
 	}
 	catch (const std::exception &e)
 	{
@@ -27,12 +441,722 @@ Object ReadFile(const CallbackInfo &info)
 		return EMPTY;
 	}
 
-	return reader.object;
+	return ToObject(env, reader, Uint8Array(), compact);
+}
+
+Value ReadPathAsync(const CallbackInfo &info)
+{
+	Env env = info.Env();
+
+	if (!info.Length() || !info[0].IsString())
+	{
+		Promise::Deferred deferred = Promise::Deferred::New(env);
+		deferred.Reject(TypeError::New(env, "Expected a file path").Value());
+		return deferred.Promise();
+	}
+
+	AsepriteReader::LoadOptions options;
+	bool compact = false;
+	ReadOptions(info, options, &compact);
+
+	ReadFileWorker *worker = new ReadFileWorker(env, info[0].As<String>().Utf8Value(), options, compact);
+	Promise promise = worker->GetPromise();
+	worker->Queue();
+	return promise;
+}
+
+// buildFrameIndex(bufferOrPath): the serialized frame index of the file
+static Value BuildFrameIndex(const CallbackInfo &info)
+{
+	Env env = info.Env();
+
+	if (!info.Length() || !(info[0].IsTypedArray() || info[0].IsString()))
+	{
+		TypeError::New(env, "Expected a Uint8Array or a file path").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	std::vector<uint8_t> serialized;
+	try
+	{
+		if (info[0].IsString())
+		{
+			// Only the frame headers of the mapping are touched
+			const std::string path = info[0].As<String>().Utf8Value();
+			MappedFile mapped;
+			if (!mapped.open(path))
+				throw std::runtime_error(mapped.error());
+			if (mapped.size() > UINT32_MAX)
+				throw std::runtime_error("File too large: " + path);
+			serialized = AsepriteReader::buildFrameIndex(mapped.data(), (uint32_t)mapped.size()).serialize();
+		}
+		else
+		{
+			Uint8Array buffer = info[0].As<Uint8Array>();
+			serialized = AsepriteReader::buildFrameIndex(buffer.Data(), buffer.ByteLength()).serialize();
+		}
+	}
+	catch (const std::exception &e)
+	{
+		Error::New(env, e.what()).ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	Uint8Array result = Uint8Array::New(env, serialized.size());
+	memcpy(result.Data(), serialized.data(), serialized.size());
+	return result;
+}
+
+// readAsepriteFrames(bufferOrPath, first, last?, options?), options.index
+// being a serialized frame index of the same file. Never cached.
+static Value ReadFrames(const CallbackInfo &info)
+{
+	Env env = info.Env();
+
+	if (info.Length() < 2 || !(info[0].IsTypedArray() || info[0].IsString()) || !info[1].IsNumber())
+	{
+		TypeError::New(env, "Expected a Uint8Array or a file path, and a frame index").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	const int first = info[1].As<Number>().Int32Value();
+	const int last = info.Length() > 2 && info[2].IsNumber() ? info[2].As<Number>().Int32Value() : first;
+	if (first < 0 || last < first)
+	{
+		RangeError::New(env, "Invalid frame range").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	AsepriteReader::LoadOptions options;
+	bool compact = false;
+	Value index;
+	if (info.Length() > 3 && info[3].IsObject())
+	{
+		ReadOptions(info[3].As<Object>(), options, &compact);
+		index = info[3].As<Object>().Get("index");
+	}
+
+	std::shared_ptr<AsepriteReader> reader = std::make_shared<AsepriteReader>();
+	reader->options = options;
+	Uint8Array buffer;
+
+	try
+	{
+		AsepriteReader::FrameIndex frameIndex;
+		if (index.IsTypedArray())
+		{
+			Uint8Array serialized = index.As<Uint8Array>();
+			frameIndex = AsepriteReader::FrameIndex::deserialize(serialized.Data(), serialized.ByteLength());
+		}
+
+		if (info[0].IsString())
+		{
+			reader->loadFileFrames(info[0].As<String>().Utf8Value(), index.IsTypedArray() ? &frameIndex : nullptr, first, last);
+		}
+		else
+		{
+			buffer = info[0].As<Uint8Array>();
+			if (!index.IsTypedArray())
+				frameIndex = AsepriteReader::buildFrameIndex(buffer.Data(), buffer.ByteLength());
+			reader->loadFrames(buffer.Data(), buffer.ByteLength(), frameIndex, first, last);
+		}
+	}
+	catch (const std::exception &e)
+	{
+		Error::New(env, e.what()).ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	return ToObject(env, reader, buffer, compact);
+}
+
+// Parses a list of buffers and paths with a pool of native threads. Every file
+// gets a { aseprite } or { error } result: one bad file does not fail the
+// others. With onResult, results are also handed to JS as soon as their file
+// is done, through the progress queue.
+class ReadBatchWorker : public AsyncProgressQueueWorker<uint32_t>
+{
+public:
+	ReadBatchWorker(Napi::Env env, Array inputs, const AsepriteReader::LoadOptions &options, bool compact, unsigned concurrency, Function onResult)
+		: AsyncProgressQueueWorker(env, "AsepriteReaderBatch"),
+		  deferred(Promise::Deferred::New(env)),
+		  items(inputs.Length()),
+		  options(options),
+		  compact(compact),
+		  concurrency(concurrency),
+		  cache(env.GetInstanceData<ParseCache>())
+	{
+		// Own array, so the buffers stay alive whatever happens to `inputs`
+		Array sources = Array::New(env, items.size());
+		for (uint32_t i = 0; i < items.size(); i++)
+		{
+			Value input = inputs.Get(i);
+			Item &item = items[i];
+
+			if (input.IsString())
+			{
+				item.path = input.As<String>().Utf8Value();
+				item.fromPath = true;
+			}
+			else if (input.IsTypedArray() && input.As<TypedArray>().TypedArrayType() == napi_uint8_array)
+			{
+				Uint8Array buffer = input.As<Uint8Array>();
+				item.data = buffer.Data();
+				item.size = buffer.ByteLength();
+				sources.Set(i, buffer);
+			}
+			else
+				item.error = "Expected a Uint8Array or a file path";
+		}
+
+		this->sources = Persistent(sources);
+		results = Persistent(Array::New(env, items.size()));
+		if (!onResult.IsEmpty())
+		{
+			this->onResult = Persistent(onResult);
+			streaming = true;
+		}
+	}
+
+	Promise GetPromise() { return deferred.Promise(); }
+
+protected:
+	void Execute(const ExecutionProgress &progress) override
+	{
+		try
+		{
+			parallelFor(items.size(), concurrency, [&](size_t i)
+			{
+				Item &item = items[i];
+
+				if (item.error.empty())
+				{
+					try
+					{
+						item.reader = LoadReader(cache, options, item.data, item.size, item.fromPath ? &item.path : nullptr);
+					}
+					catch (const std::exception &e)
+					{
+						item.error = e.what();
+					}
+				}
+
+				if (streaming)
+				{
+					uint32_t index = (uint32_t)i;
+					progress.Send(&index, 1);
+				}
+			});
+		}
+		catch (const std::exception &e)
+		{
+			SetError(e.what());
+		}
+	}
+
+	void OnProgress(const uint32_t *indices, size_t count) override
+	{
+		for (size_t i = 0; i < count; i++)
+			Deliver(indices[i]);
+	}
+
+	void OnOK() override
+	{
+		for (uint32_t i = 0; i < items.size(); i++)
+			Deliver(i);
+
+		if (!callbackError.IsEmpty())
+			deferred.Reject(callbackError.Value());
+		else
+			deferred.Resolve(results.Value());
+	}
+
+	void OnError(const Error &e) override
+	{
+		deferred.Reject(e.Value());
+	}
+
+private:
+	struct Item
+	{
+		const uint8_t *data = nullptr;
+		size_t size = 0;
+		std::string path;
+		bool fromPath = false;
+		std::shared_ptr<AsepriteReader> reader;
+		std::string error;
+		bool delivered = false;
+	};
+
+	// Builds the result of a finished file once, then passes it to onResult
+	void Deliver(uint32_t index)
+	{
+		Napi::Env env = Env();
+		Item &item = items[index];
+
+		if (item.delivered)
+			return;
+		item.delivered = true;
+
+		Object result = Object::New(env);
+		Object aseprite;
+		if (item.reader)
+			aseprite = ToObject(env, std::move(item.reader), item.fromPath ? Uint8Array() : sources.Value().Get(index).As<Uint8Array>(), compact);
+
+		if (env.IsExceptionPending())
+			result["error"] = env.GetAndClearPendingException().Value();
+		else if (!aseprite.IsEmpty())
+			result["aseprite"] = aseprite;
+		else
+			result["error"] = Error::New(env, item.error).Value();
+		results.Value().Set(index, result);
+
+		// The first exception thrown by the callback rejects the batch
+		if (streaming)
+		{
+			onResult.Call({result, Number::New(env, index)});
+			if (env.IsExceptionPending())
+			{
+				Error error = env.GetAndClearPendingException();
+				if (callbackError.IsEmpty())
+					callbackError = Persistent(error.Value());
+			}
+		}
+	}
+
+	Promise::Deferred deferred;
+	std::vector<Item> items;
+	Reference<Array> sources;
+	Reference<Array> results;
+	FunctionReference onResult;
+	bool streaming = false;
+	ObjectReference callbackError;
+	AsepriteReader::LoadOptions options;
+	bool compact;
+	unsigned concurrency;
+	ParseCache *cache;
+};
+
+// readAsepriteBatch(inputs, { concurrency?, onResult?, ...ReadOptions })
+Value ReadBatch(const CallbackInfo &info)
+{
+	Env env = info.Env();
+
+	if (!info.Length() || !info[0].IsArray())
+	{
+		Promise::Deferred deferred = Promise::Deferred::New(env);
+		deferred.Reject(TypeError::New(env, "Expected an array of buffers or file paths").Value());
+		return deferred.Promise();
+	}
+
+	AsepriteReader::LoadOptions options;
+	bool compact = false;
+	ReadOptions(info, options, &compact);
+
+	// One file per core by default, each decoded on its own thread
+	unsigned concurrency = 0;
+	Function onResult;
+	if (info.Length() > 1 && info[1].IsObject())
+	{
+		Object object = info[1].As<Object>();
+
+		Value value = object.Get("concurrency");
+		if (value.IsNumber())
+			concurrency = value.As<Number>().Uint32Value();
+
+		value = object.Get("onResult");
+		if (value.IsFunction())
+			onResult = value.As<Function>();
+	}
+
+	ReadBatchWorker *worker = new ReadBatchWorker(env, info[0].As<Array>(), options, compact, concurrency, onResult);
+	Promise promise = worker->GetPromise();
+	worker->Queue();
+	return promise;
+}
+
+// new AsepriteStreamParser(options?). write(chunk) returns the events
+// completed by the chunk, end() the Aseprite object of the whole file.
+class StreamParser : public ObjectWrap<StreamParser>
+{
+public:
+	static Function Init(Napi::Env env)
+	{
+		return DefineClass(env, "AsepriteStreamParser", {
+			InstanceMethod("write", &StreamParser::Write),
+			InstanceMethod("end", &StreamParser::End),
+		});
+	}
+
+	StreamParser(const CallbackInfo &info) : ObjectWrap<StreamParser>(info)
+	{
+		AsepriteReader::LoadOptions options;
+		if (info.Length() && info[0].IsObject())
+			ReadOptions(info[0].As<Object>(), options, &compact);
+
+		parser.reset(new AsepriteStreamParser(options));
+		parser->onHeader = [this](const AsepriteReader::AsepriteFile &)
+		{ events.push_back({Event::HEADER, nullptr, 0}); };
+		parser->onLayer = [this](AsepriteReader::Layer *layer)
+		{ events.push_back({Event::LAYER, layer, 0}); };
+		parser->onCel = [this](AsepriteReader::Cel *cel)
+		{ events.push_back({Event::CEL, cel, (unsigned)parser->reader().file.frames.size() - 1}); };
+		parser->onFrame = [this](AsepriteReader::Frame *frame, unsigned index)
+		{ events.push_back({Event::FRAME, frame, index}); };
+	}
+
+private:
+	struct Event
+	{
+		enum Type
+		{
+			HEADER,
+			LAYER,
+			CEL,
+			FRAME,
+		} type;
+		void *item;
+		unsigned frame;
+	};
+
+	std::unique_ptr<AsepriteStreamParser> parser;
+	std::vector<Event> events;
+	bool compact = false;
+
+	Napi::Value Write(const CallbackInfo &info)
+	{
+		Napi::Env env = info.Env();
+
+		if (!parser)
+		{
+			Error::New(env, "Stream already ended").ThrowAsJavaScriptException();
+			return env.Undefined();
+		}
+		if (!info.Length() || !info[0].IsTypedArray())
+		{
+			TypeError::New(env, "Expected one Uint8Array argument").ThrowAsJavaScriptException();
+			return env.Undefined();
+		}
+
+		Uint8Array chunk = info[0].As<Uint8Array>();
+		events.clear();
+
+		try
+		{
+			parser->write(chunk.Data(), chunk.ByteLength());
+		}
+		catch (const std::exception &e)
+		{
+			Error::New(env, e.what()).ThrowAsJavaScriptException();
+			return env.Undefined();
+		}
+
+		Array result = Array::New(env, events.size());
+		for (uint32_t i = 0; i < events.size(); i++)
+			result[i] = EventObject(env, events[i]);
+		return result;
+	}
+
+	Napi::Value End(const CallbackInfo &info)
+	{
+		Napi::Env env = info.Env();
+
+		if (!parser)
+		{
+			Error::New(env, "Stream already ended").ThrowAsJavaScriptException();
+			return env.Undefined();
+		}
+
+		try
+		{
+			parser->end();
+		}
+		catch (const std::exception &e)
+		{
+			Error::New(env, e.what()).ThrowAsJavaScriptException();
+			return env.Undefined();
+		}
+
+		std::shared_ptr<AsepriteReader> reader = parser->release();
+		parser.reset();
+		return ToObject(env, reader, Uint8Array(), compact);
+	}
+
+	Object EventObject(Napi::Env env, const Event &event)
+	{
+		Object object = Object::New(env);
+
+		switch (event.type)
+		{
+		case Event::HEADER:
+		{
+			const AsepriteReader::AsepriteFile &file = parser->reader().file;
+			Object header = Object::New(env);
+			header["width"] = Number::New(env, file.width);
+			header["height"] = Number::New(env, file.height);
+			header["colorDepth"] = Number::New(env, file.colorDepth);
+			// Cels come converted already, setPixelFormat only describes it at the end
+			const AsepriteReader::PixelFormat format = parser->reader().options.outputFormat();
+			header["pixelFormat"] = String::New(env, AsepriteReader::pixelFormatName(format));
+			header["pixelDepth"] = Number::New(env, (double)(pixelFormatBytes(format, file.colorDepth) * 8));
+			header["numFrames"] = Number::New(env, file.numFrames);
+			header["numColors"] = Number::New(env, file.numColors);
+			header["pixelRatio"] = Number::New(env, file.pixelRatio);
+			object["type"] = String::New(env, "header");
+			object["header"] = header;
+		}
+		break;
+
+		case Event::LAYER:
+		{
+			const AsepriteReader::Layer *layer = static_cast<AsepriteReader::Layer *>(event.item);
+			Object objLayer = Object::New(env);
+			objLayer["name"] = String::New(env, layer->name);
+			objLayer["index"] = Number::New(env, layer->index);
+			objLayer["type"] = Number::New(env, layer->type);
+			objLayer["flags"] = Number::New(env, layer->flags);
+			objLayer["opacity"] = Number::New(env, layer->opacity);
+			objLayer["blendMode"] = Number::New(env, (uint16_t)layer->blendMode);
+			if (layer->layerParent)
+				objLayer["parent"] = Number::New(env, layer->layerParent->index);
+			if (layer->tileset)
+				objLayer["tilesetIndex"] = Number::New(env, layer->tilesetIndex);
+			object["type"] = String::New(env, "layer");
+			object["layer"] = objLayer;
+		}
+		break;
+
+		case Event::CEL:
+		{
+			const AsepriteReader::Cel *cel = static_cast<AsepriteReader::Cel *>(event.item);
+			Object objCel = Object::New(env);
+			objCel["frame"] = Number::New(env, event.frame);
+			objCel["layer"] = Number::New(env, cel->layer->index);
+			objCel["x"] = Number::New(env, cel->x);
+			objCel["y"] = Number::New(env, cel->y);
+			objCel["w"] = Number::New(env, cel->w);
+			objCel["h"] = Number::New(env, cel->h);
+			objCel["opacity"] = Number::New(env, cel->opacity);
+			if (cel->link >= 0)
+				objCel["link"] = Number::New(env, cel->link);
+			if (cel->tilemap)
+				objCel["tilemap"] = Boolean::New(env, true);
+			ArrayBuffer buffer = AsepriteReader::pixelBuffer(env, cel->pixels, cel->pixelsLength);
+			objCel["pixels"] = Uint8Array::New(env, cel->pixelsLength, buffer, 0);
+			object["type"] = String::New(env, "cel");
+			object["cel"] = objCel;
+		}
+		break;
+
+		case Event::FRAME:
+		{
+			const AsepriteReader::Frame *frame = static_cast<AsepriteReader::Frame *>(event.item);
+			Object objFrame = Object::New(env);
+			objFrame["duration"] = Number::New(env, frame->duration);
+			object["type"] = String::New(env, "frame");
+			object["index"] = Number::New(env, event.frame);
+			object["frame"] = objFrame;
+		}
+		break;
+		}
+
+		return object;
+	}
+};
+
+static Object NewRect(Env env, int x, int y, int w, int h)
+{
+	Object rect = Object::New(env);
+	rect["x"] = Number::New(env, x);
+	rect["y"] = Number::New(env, y);
+	rect["w"] = Number::New(env, w);
+	rect["h"] = Number::New(env, h);
+	return rect;
+}
+
+static void ReadAtlasOptions(const CallbackInfo &info, AtlasOptions &options)
+{
+	if (info.Length() < 2 || !info[1].IsObject())
+		return;
+
+	Object object = info[1].As<Object>();
+	auto readNumber = [&](const char *name, unsigned &value)
+	{
+		Value v = object.Get(name);
+		if (v.IsNumber())
+			value = v.As<Number>().Uint32Value();
+	};
+	auto readBoolean = [&](const char *name, bool &value)
+	{
+		Value v = object.Get(name);
+		if (!v.IsUndefined())
+			value = v.ToBoolean().Value();
+	};
+
+	readNumber("maxSize", options.maxSize);
+	readNumber("padding", options.padding);
+	readNumber("threads", options.threads);
+	readBoolean("trim", options.trim);
+	readBoolean("dedupe", options.dedupe);
+	readBoolean("powerOfTwo", options.powerOfTwo);
+	readBoolean("includeHidden", options.includeHidden);
+}
+
+// packAtlas([ase, ...], options?). Frames follow the field names of
+// Aseprite's JSON sprite sheet export; tags and slices are the ones of the
+// parsed objects.
+static Value PackAtlas(const CallbackInfo &info)
+{
+	Env env = info.Env();
+
+	if (!info.Length() || !info[0].IsArray())
+	{
+		TypeError::New(env, "Expected an array of parsed Aseprite objects").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	Array input = info[0].As<Array>();
+	std::vector<AsepriteReader *> sprites;
+
+	for (uint32_t i = 0; i < input.Length(); i++)
+	{
+		AsepriteReader *reader = UnwrapReader(env, input.Get(i));
+		if (!reader)
+		{
+			TypeError::New(env, "packAtlas expects objects returned by readAseprite or readAsepriteAsync").ThrowAsJavaScriptException();
+			return env.Undefined();
+		}
+		sprites.push_back(reader);
+	}
+
+	AtlasOptions options;
+	ReadAtlasOptions(info, options);
+	Atlas atlas;
+
+	try
+	{
+		atlas = packAtlas(sprites, options);
+	}
+	catch (const std::exception &e)
+	{
+		Error::New(env, e.what()).ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	Object result = Object::New(env);
+	Array pages = Array::New(env, atlas.pages.size());
+	Array objSprites = Array::New(env, sprites.size());
+	result["pages"] = pages;
+	result["sprites"] = objSprites;
+
+	for (uint32_t i = 0; i < atlas.pages.size(); i++)
+	{
+		const AtlasPage &page = atlas.pages[i];
+		Uint8Array pixels = Uint8Array::New(env, page.pixels.size());
+		memcpy(pixels.Data(), page.pixels.data(), page.pixels.size());
+
+		Object objPage = Object::New(env);
+		objPage["width"] = Number::New(env, page.width);
+		objPage["height"] = Number::New(env, page.height);
+		objPage["pixels"] = pixels;
+		pages[i] = objPage;
+	}
+
+	size_t next = 0;
+	for (uint32_t i = 0; i < sprites.size(); i++)
+	{
+		Object ase = input.Get(i).As<Object>();
+		const size_t count = sprites[i]->file.frames.size();
+		Array frames = Array::New(env, count);
+
+		for (uint32_t f = 0; f < count; f++, next++)
+		{
+			const AtlasFrame &frame = atlas.frames[next];
+			Object objFrame = Object::New(env);
+			objFrame["page"] = Number::New(env, frame.page);
+			objFrame["frame"] = NewRect(env, frame.x, frame.y, frame.w, frame.h);
+			objFrame["rotated"] = Boolean::New(env, false);
+			objFrame["trimmed"] = Boolean::New(env, frame.trimmed);
+			objFrame["spriteSourceSize"] = NewRect(env, frame.sourceX, frame.sourceY, frame.w, frame.h);
+
+			Object sourceSize = Object::New(env);
+			sourceSize["w"] = Number::New(env, frame.sourceW);
+			sourceSize["h"] = Number::New(env, frame.sourceH);
+			objFrame["sourceSize"] = sourceSize;
+			objFrame["duration"] = Number::New(env, frame.duration);
+			frames[f] = objFrame;
+		}
+
+		Object objSprite = Object::New(env);
+		objSprite["frames"] = frames;
+		objSprite["tags"] = ase.Get("tags");
+		objSprite["slices"] = ase.Get("slices");
+		objSprites[i] = objSprite;
+	}
+
+	return result;
+}
+
+static Object CacheStatsObject(Env env)
+{
+	const ParseCache::Stats stats = env.GetInstanceData<ParseCache>()->stats();
+	Object object = Object::New(env);
+	object["hits"] = Number::New(env, (double)stats.hits);
+	object["misses"] = Number::New(env, (double)stats.misses);
+	object["evictions"] = Number::New(env, (double)stats.evictions);
+	object["entries"] = Number::New(env, (double)stats.entries);
+	object["bytes"] = Number::New(env, (double)stats.bytes);
+	object["maxBytes"] = Number::New(env, (double)stats.maxBytes);
+	return object;
+}
+
+// configureCache({ maxBytes }), maxBytes 0 disables the cache
+static Value ConfigureCache(const CallbackInfo &info)
+{
+	Env env = info.Env();
+
+	if (!info.Length() || !info[0].IsObject())
+	{
+		TypeError::New(env, "Expected an options object").ThrowAsJavaScriptException();
+		return env.Undefined();
+	}
+
+	Value maxBytes = info[0].As<Object>().Get("maxBytes");
+	if (maxBytes.IsNumber())
+		env.GetInstanceData<ParseCache>()->setMaxBytes((size_t)std::max(0.0, maxBytes.As<Number>().DoubleValue()));
+
+	return CacheStatsObject(env);
+}
+
+static Value CacheStats(const CallbackInfo &info)
+{
+	return CacheStatsObject(info.Env());
+}
+
+static Value ClearCache(const CallbackInfo &info)
+{
+	info.Env().GetInstanceData<ParseCache>()->clear();
+	return info.Env().Undefined();
 }
 
 Object Init(Env env, Object exports)
 {
+	// One cache per environment (main thread or worker), off until configured
+	env.SetInstanceData(new ParseCache());
+
 	exports.Set(String::New(env, "AsepriteReader"), Function::New(env, ReadFile));
+	exports.Set(String::New(env, "AsepriteReaderAsync"), Function::New(env, ReadFileAsync));
+	exports.Set(String::New(env, "AsepriteReaderInfo"), Function::New(env, ReadInfo));
+	exports.Set(String::New(env, "AsepriteReaderFile"), Function::New(env, ReadPath));
+	exports.Set(String::New(env, "AsepriteReaderFileAsync"), Function::New(env, ReadPathAsync));
+	exports.Set(String::New(env, "AsepriteReaderBatch"), Function::New(env, ReadBatch));
+	exports.Set(String::New(env, "AsepriteReaderFrames"), Function::New(env, ReadFrames));
+	exports.Set(String::New(env, "AsepriteFrameIndex"), Function::New(env, BuildFrameIndex));
+	exports.Set(String::New(env, "AsepriteStreamParser"), StreamParser::Init(env));
+	exports.Set(String::New(env, "AsepritePackAtlas"), Function::New(env, PackAtlas));
+	exports.Set(String::New(env, "AsepriteConfigureCache"), Function::New(env, ConfigureCache));
+	exports.Set(String::New(env, "AsepriteCacheStats"), Function::New(env, CacheStats));
+	exports.Set(String::New(env, "AsepriteClearCache"), Function::New(env, ClearCache));
 	return exports;
 }
 
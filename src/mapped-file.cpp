@@ -0,0 +1,125 @@
+/*
+ * mapped-file.cpp
+ */
+
+#include "mapped-file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &path)
+{
+	close();
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		message = "Cannot open " + path;
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		CloseHandle(file);
+		message = "Cannot read the size of " + path;
+		return false;
+	}
+
+	// Empty files cannot be mapped, they stay as a null range
+	if (fileSize.QuadPart > 0)
+	{
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping)
+			bytes = static_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+		if (!bytes)
+		{
+			CloseHandle(file);
+			close();
+			message = "Cannot map " + path;
+			return false;
+		}
+	}
+
+	// The mapping keeps the file open
+	CloseHandle(file);
+	length = (size_t)fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (bytes)
+		UnmapViewOfFile(bytes);
+	if (mapping)
+		CloseHandle(mapping);
+
+	bytes = nullptr;
+	mapping = nullptr;
+	length = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string &path)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		message = "Cannot open " + path + ": " + strerror(errno);
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		message = "Cannot read the size of " + path + ": " + strerror(errno);
+		::close(fd);
+		return false;
+	}
+
+	// Empty files cannot be mapped, they stay as a null range
+	if (info.st_size > 0)
+	{
+		void *address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (address == MAP_FAILED)
+		{
+			message = "Cannot map " + path + ": " + strerror(errno);
+			::close(fd);
+			return false;
+		}
+
+		madvise(address, (size_t)info.st_size, MADV_SEQUENTIAL);
+		bytes = static_cast<const uint8_t *>(address);
+	}
+
+	// The mapping keeps the file open
+	::close(fd);
+	length = (size_t)info.st_size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (bytes)
+		munmap(const_cast<uint8_t *>(bytes), length);
+
+	bytes = nullptr;
+	length = 0;
+}
+
+#endif
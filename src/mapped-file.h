@@ -0,0 +1,38 @@
+/*
+ * mapped-file.h
+ *
+ *  Read-only memory mapping of a whole file, so it can be parsed without
+ *  copying it to the heap first.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile final
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	~MappedFile() { close(); }
+
+	// Maps `path`, hinting the kernel that it is read front to back. Returns
+	// false and sets error() on failure.
+	bool open(const std::string &path);
+	void close();
+
+	const uint8_t *data() const { return bytes; }
+	size_t size() const { return length; }
+	const std::string &error() const { return message; }
+
+private:
+	const uint8_t *bytes = nullptr;
+	size_t length = 0;
+	std::string message;
+#ifdef _WIN32
+	void *mapping = nullptr;
+#endif
+};
@@ -0,0 +1,78 @@
+/*
+ * parallel.h
+ *
+ *  Minimal fork/join helper used to spread independent work items
+ *  (cel decompression, batch parsing) over a few threads.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Resolves a requested thread count, 0 meaning one thread per core
+inline unsigned resolveThreadCount(unsigned threads)
+{
+	if (threads)
+		return threads;
+
+	unsigned cores = std::thread::hardware_concurrency();
+	return cores ? cores : 1;
+}
+
+// Calls fn(i) for every i in [0, count) using up to `threads` threads
+// (the calling thread included). Items are handed out one at a time, so
+// uneven work still balances. The first exception thrown by any item is
+// rethrown once all threads have finished.
+template <typename Fn>
+void parallelFor(size_t count, unsigned threads, Fn fn)
+{
+	threads = (unsigned)std::min<size_t>(resolveThreadCount(threads), count);
+
+	if (threads <= 1)
+	{
+		for (size_t i = 0; i < count; i++)
+			fn(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	std::exception_ptr error;
+	std::mutex errorMutex;
+
+	auto work = [&]()
+	{
+		for (size_t i = next++; i < count; i = next++)
+		{
+			try
+			{
+				fn(i);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error)
+					error = std::current_exception();
+				next = count;
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	pool.reserve(threads - 1);
+	for (unsigned i = 1; i < threads; i++)
+		pool.emplace_back(work);
+
+	work();
+
+	for (auto &thread : pool)
+		thread.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
@@ -0,0 +1,141 @@
+/*
+ * parse-cache.cpp
+ */
+
+#include "parse-cache.h"
+#include "xxhash64.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// Options that change the parsed result are part of the key
+static uint64_t optionsSeed(const AsepriteReader::LoadOptions &options)
+{
+	// 0 and 1 as when `rgba` was the only format option
+	const uint64_t seed = (uint64_t)options.outputFormat() | (options.dedup ? 8 : 0);
+	if (!options.selects())
+		return seed;
+
+	// Names end with a 0 and lists with a 1
+	std::string selection;
+	for (const std::string &name : options.layers)
+		selection.append(name).push_back('\0');
+	selection.push_back('\1');
+	for (const std::string &name : options.tags)
+		selection.append(name).push_back('\0');
+	selection.push_back('\1');
+	selection += std::to_string(options.firstFrame) + ',' + std::to_string(options.lastFrame) + (options.visibleOnly ? 'v' : '-');
+
+	return xxHash64(selection.data(), selection.size(), seed + 4);
+}
+
+uint64_t ParseCache::bufferKey(const uint8_t *data, size_t size, const AsepriteReader::LoadOptions &options)
+{
+	return xxHash64(data, size, optionsSeed(options));
+}
+
+bool ParseCache::fileKey(const std::string &path, const AsepriteReader::LoadOptions &options, uint64_t &key)
+{
+	int64_t stamp[3] = {0, 0, 0}; // size, seconds, nanoseconds
+
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(path.c_str(), &info) != 0)
+		return false;
+	stamp[1] = info.st_mtime;
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return false;
+	stamp[1] = info.st_mtime;
+#if defined(__APPLE__)
+	stamp[2] = info.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+	stamp[2] = info.st_mtim.tv_nsec;
+#endif
+#endif
+	stamp[0] = info.st_size;
+
+	// Paths and contents hash apart: a different seed, and the stamp
+	key = xxHash64(stamp, sizeof(stamp), xxHash64(path.data(), path.size(), optionsSeed(options) + 2));
+	return true;
+}
+
+void ParseCache::setMaxBytes(size_t maxBytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	counters.maxBytes = maxBytes;
+	evict();
+}
+
+bool ParseCache::enabled() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return counters.maxBytes > 0;
+}
+
+std::shared_ptr<AsepriteReader> ParseCache::find(uint64_t key)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto found = index.find(key);
+	if (found == index.end())
+	{
+		counters.misses++;
+		return nullptr;
+	}
+
+	counters.hits++;
+	entries.splice(entries.begin(), entries, found->second);
+	return found->second->reader;
+}
+
+void ParseCache::insert(uint64_t key, const std::shared_ptr<AsepriteReader> &reader)
+{
+	const size_t bytes = reader->memoryFootprint();
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (bytes > counters.maxBytes)
+		return;
+
+	// Two loads of the same file may finish one after the other
+	auto found = index.find(key);
+	if (found != index.end())
+	{
+		counters.bytes -= found->second->bytes;
+		entries.erase(found->second);
+		index.erase(found);
+	}
+
+	entries.push_front({key, reader, bytes});
+	index[key] = entries.begin();
+	counters.bytes += bytes;
+	evict();
+}
+
+void ParseCache::clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	entries.clear();
+	index.clear();
+	counters.bytes = 0;
+}
+
+ParseCache::Stats ParseCache::stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Stats result = counters;
+	result.entries = entries.size();
+	return result;
+}
+
+void ParseCache::evict()
+{
+	while (!entries.empty() && counters.bytes > counters.maxBytes)
+	{
+		counters.bytes -= entries.back().bytes;
+		counters.evictions++;
+		index.erase(entries.back().key);
+		entries.pop_back();
+	}
+}
@@ -0,0 +1,77 @@
+/*
+ * parse-cache.h
+ *
+ *  Parsed files kept in memory for repeated loads, keyed by a hash of their
+ *  content (or of their path, size and modification time). Entries are
+ *  dropped least recently used first to stay within a byte budget.
+ *
+ *  Cached readers are shared with every caller that hits them, so they
+ *  must be treated as read-only. Lazy loads are never cached: their cels
+ *  read from the caller's buffer.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "aseprite-reader.h"
+
+class ParseCache final
+{
+public:
+	struct Stats
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		size_t entries = 0;
+		size_t bytes = 0;
+		size_t maxBytes = 0;
+	};
+
+	// A budget of 0 leaves the cache disabled
+	explicit ParseCache(size_t maxBytes = 0) { counters.maxBytes = maxBytes; }
+
+	// Changing the budget evicts what no longer fits, 0 empties the cache
+	void setMaxBytes(size_t maxBytes);
+	bool enabled() const;
+
+	// Whether loads with these options may be cached at all. Instrumented
+	// loads are not, their stats describe an actual parse.
+	static bool cacheable(const AsepriteReader::LoadOptions &options) { return !options.lazy && !options.stats; }
+
+	// Key of a file in memory
+	static uint64_t bufferKey(const uint8_t *data, size_t size, const AsepriteReader::LoadOptions &options);
+	// Key of a file on disk, from its path, size and modification time.
+	// Returns false if the file cannot be found.
+	static bool fileKey(const std::string &path, const AsepriteReader::LoadOptions &options, uint64_t &key);
+
+	// Returns the cached reader, or null. Counts a hit or a miss.
+	std::shared_ptr<AsepriteReader> find(uint64_t key);
+	// Adds a parsed file, unless it is larger than the whole budget
+	void insert(uint64_t key, const std::shared_ptr<AsepriteReader> &reader);
+	void clear();
+
+	Stats stats() const;
+
+private:
+	struct Entry
+	{
+		uint64_t key;
+		std::shared_ptr<AsepriteReader> reader;
+		size_t bytes;
+	};
+
+	mutable std::mutex mutex;
+	std::list<Entry> entries; // most recently used first
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+	Stats counters;
+
+	// Drops entries until the budget is met, mutex held
+	void evict();
+};
@@ -0,0 +1,108 @@
+/*
+ * xxhash64.cpp
+ *
+ *  Straight implementation of the XXH64 spec. Input words are read in host
+ *  order, which matches the reference hashes on little endian machines;
+ *  keys only have to be stable within a process.
+ */
+
+#include "xxhash64.h"
+
+#include <cstring>
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint64_t xxRound(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME2;
+	acc = rotl(acc, 31);
+	return acc * PRIME1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t value)
+{
+	acc ^= xxRound(0, value);
+	return acc * PRIME1 + PRIME4;
+}
+
+uint64_t xxHash64(const void *data, size_t length, uint64_t seed)
+{
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	const uint8_t *end = p + length;
+	uint64_t h;
+
+	if (length >= 32)
+	{
+		uint64_t v1 = seed + PRIME1 + PRIME2;
+		uint64_t v2 = seed + PRIME2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME1;
+
+		for (; end - p >= 32; p += 32)
+		{
+			v1 = xxRound(v1, read64(p));
+			v2 = xxRound(v2, read64(p + 8));
+			v3 = xxRound(v3, read64(p + 16));
+			v4 = xxRound(v4, read64(p + 24));
+		}
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = mergeRound(h, v1);
+		h = mergeRound(h, v2);
+		h = mergeRound(h, v3);
+		h = mergeRound(h, v4);
+	}
+	else
+	{
+		h = seed + PRIME5;
+	}
+
+	h += length;
+
+	for (; end - p >= 8; p += 8)
+	{
+		h ^= xxRound(0, read64(p));
+		h = rotl(h, 27) * PRIME1 + PRIME4;
+	}
+	if (end - p >= 4)
+	{
+		h ^= read32(p) * PRIME1;
+		h = rotl(h, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; p++)
+	{
+		h ^= *p * PRIME5;
+		h = rotl(h, 11) * PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
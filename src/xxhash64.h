@@ -0,0 +1,12 @@
+/*
+ * xxhash64.h
+ *
+ *  XXH64 (https://github.com/Cyan4973/xxHash), used to key the parse cache.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+uint64_t xxHash64(const void *data, size_t length, uint64_t seed = 0);
@@ -0,0 +1,338 @@
+/*
+ * aseprite-corpus.h
+ *
+ *  Synthetic Aseprite files for benchmarks and tests: builds a file in
+ *  memory from a few parameters (canvas, frames, layers, color depth, cel
+ *  storage, tags, slices, a layer group). Output is deterministic for a given spec, pixels are flat areas
+ *  with some noise so they compress like real sprites.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+enum CelStorage
+{
+	CELS_RAW,		 // uncompressed pixels
+	CELS_COMPRESSED, // zlib, like Aseprite saves them
+	CELS_LINKED,	 // compressed every 4th frame, the others link back to it
+	CELS_CHAINED,	 // as linked, each link to the previous frame, linked itself
+};
+
+struct CorpusSpec
+{
+	std::string name;
+	int width = 64;
+	int height = 64;
+	int frames = 8;
+	int layers = 2;
+	int colorDepth = 32; // 8, 16 or 32
+	CelStorage cels = CELS_COMPRESSED;
+	int tags = 0;
+	int slices = 0;
+	int groupOpacity = 0; // 1-255 puts the layers above the first in a group
+	bool layerOpacity = true; // header flag, layers store 0 as opacity without it
+	uint32_t seed = 1;
+};
+
+class CorpusWriter
+{
+public:
+	explicit CorpusWriter(const CorpusSpec &spec) : spec(spec), state(spec.seed ? spec.seed : 1) {}
+
+	std::vector<uint8_t> write()
+	{
+		const int bytesPerPixel = spec.colorDepth / 8;
+
+		// Header, its size patched at the end
+		putUInt32(0);
+		putUInt16(0xA5E0);
+		putUInt16(spec.frames);
+		putUInt16(spec.width);
+		putUInt16(spec.height);
+		putUInt16(spec.colorDepth);
+		putUInt32((spec.layerOpacity ? 1 : 0) | (spec.groupOpacity ? 2 : 0)); // layer and group opacity are valid
+		putUInt16(100);
+		putZeros(8);
+		putUInt8(0); // transparent index
+		putZeros(3);
+		putUInt16(spec.colorDepth == 8 ? 256 : 0);
+		putUInt8(1);
+		putUInt8(1);
+		putZeros(92);
+
+		for (int frame = 0; frame < spec.frames; frame++)
+		{
+			const size_t frameStart = out.size();
+			unsigned chunks = 0;
+
+			putUInt32(0);
+			putUInt16(0xF1FA);
+			putUInt16(0);
+			putUInt16(100);
+			putZeros(6);
+
+			if (frame == 0)
+			{
+				chunks += writePalette();
+				for (int layer = 0; layer < spec.layers; layer++)
+				{
+					if (layer == 1 && spec.groupOpacity)
+						chunks += writeGroup();
+					chunks += writeLayer(layer);
+				}
+				chunks += writeTags();
+				for (int slice = 0; slice < spec.slices; slice++)
+					chunks += writeSlice(slice);
+			}
+
+			for (int layer = 0; layer < spec.layers; layer++)
+				chunks += writeCel(frame, layer, bytesPerPixel);
+
+			patchUInt32(frameStart, (uint32_t)(out.size() - frameStart));
+			patchUInt16(frameStart + 6, chunks > 0xffff ? 0xffff : chunks);
+			patchUInt32(frameStart + 12, chunks);
+		}
+
+		patchUInt32(0, (uint32_t)out.size());
+		return std::move(out);
+	}
+
+	// Cels written with pixels, the others are links
+	static int storedCels(const CorpusSpec &spec)
+	{
+		const int stored = spec.cels == CELS_LINKED || spec.cels == CELS_CHAINED ? (spec.frames + 3) / 4 : spec.frames;
+		return stored * spec.layers;
+	}
+
+private:
+	const CorpusSpec &spec;
+	std::vector<uint8_t> out;
+	uint32_t state;
+
+	uint32_t random()
+	{
+		// xorshift32, the same on every platform
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	void putUInt8(uint8_t value) { out.push_back(value); }
+	void putUInt16(uint16_t value)
+	{
+		out.push_back(value & 0xff);
+		out.push_back(value >> 8);
+	}
+	void putUInt32(uint32_t value)
+	{
+		putUInt16(value & 0xffff);
+		putUInt16(value >> 16);
+	}
+	void putZeros(size_t count) { out.insert(out.end(), count, 0); }
+	void putString(const std::string &value)
+	{
+		putUInt16((uint16_t)value.size());
+		out.insert(out.end(), value.begin(), value.end());
+	}
+	void patchUInt16(size_t at, uint16_t value)
+	{
+		out[at] = value & 0xff;
+		out[at + 1] = value >> 8;
+	}
+	void patchUInt32(size_t at, uint32_t value)
+	{
+		patchUInt16(at, value & 0xffff);
+		patchUInt16(at + 2, value >> 16);
+	}
+
+	size_t beginChunk(uint16_t type)
+	{
+		const size_t start = out.size();
+		putUInt32(0);
+		putUInt16(type);
+		return start;
+	}
+	unsigned endChunk(size_t start)
+	{
+		patchUInt32(start, (uint32_t)(out.size() - start));
+		return 1;
+	}
+
+	unsigned writePalette()
+	{
+		const size_t chunk = beginChunk(0x2019);
+		putUInt32(256);
+		putUInt32(0);
+		putUInt32(255);
+		putZeros(8);
+		for (int i = 0; i < 256; i++)
+		{
+			putUInt16(0);
+			putUInt32(random() | 0xff000000);
+		}
+		return endChunk(chunk);
+	}
+
+	unsigned writeLayer(int layer)
+	{
+		const size_t chunk = beginChunk(0x2004);
+		putUInt16(layer == 0 ? 3 : 1); // visible (+ editable)
+		putUInt16(0);					// normal layer
+		putUInt16(layer && spec.groupOpacity ? 1 : 0); // child level
+		putZeros(4);
+		putUInt16(layer % 3 == 2 ? 1 : 0); // a few multiply layers
+		putUInt8(!spec.layerOpacity ? 0 : layer == 0 ? 255 : 192);
+		putZeros(3);
+		putString("Layer " + std::to_string(layer + 1));
+		return endChunk(chunk);
+	}
+
+	unsigned writeGroup()
+	{
+		const size_t chunk = beginChunk(0x2004);
+		putUInt16(1);	 // visible
+		putUInt16(1);	 // group
+		putUInt16(0);	 // child level
+		putZeros(4);
+		putUInt16(0);
+		putUInt8(spec.groupOpacity);
+		putZeros(3);
+		putString("Group");
+		return endChunk(chunk);
+	}
+
+	unsigned writeTags()
+	{
+		if (!spec.tags)
+			return 0;
+
+		const size_t chunk = beginChunk(0x2018);
+		putUInt16(spec.tags);
+		putZeros(8);
+		for (int tag = 0; tag < spec.tags; tag++)
+		{
+			const int from = spec.frames ? (int)(random() % spec.frames) : 0;
+			const int to = from + (spec.frames - from > 1 ? (int)(random() % (spec.frames - from)) : 0);
+			putUInt16(from);
+			putUInt16(to);
+			putUInt8(tag % 3);
+			putZeros(8);
+			putUInt32(random() & 0xffffff);
+			putString("tag" + std::to_string(tag));
+		}
+		return endChunk(chunk);
+	}
+
+	unsigned writeSlice(int slice)
+	{
+		const size_t chunk = beginChunk(0x2022);
+		const int keys = 1 + slice % 3;
+		putUInt32(keys);
+		putUInt32(slice % 2 ? 3 : 0); // 9-slice + pivot on every other slice
+		putUInt32(0);
+		putString("slice" + std::to_string(slice));
+		for (int key = 0; key < keys; key++)
+		{
+			putUInt32(spec.frames ? key * spec.frames / keys : 0);
+			putUInt32(random() % spec.width);
+			putUInt32(random() % spec.height);
+			putUInt32(1 + random() % spec.width);
+			putUInt32(1 + random() % spec.height);
+			if (slice % 2)
+			{
+				putZeros(4 * 4);
+				putZeros(4 * 2);
+			}
+		}
+		return endChunk(chunk);
+	}
+
+	unsigned writeCel(int frame, int layer, int bytesPerPixel)
+	{
+		// Upper layers get smaller cels, like sprites over a background
+		const int inset = std::min(layer * 2, std::min(spec.width, spec.height) / 4);
+		const int w = spec.width - inset * 2;
+		const int h = spec.height - inset * 2;
+
+		const size_t chunk = beginChunk(0x2005);
+		putUInt16(layer && spec.groupOpacity ? layer + 1 : layer); // after the group
+		putUInt16(inset);
+		putUInt16(inset);
+		putUInt8(255);
+
+		if ((spec.cels == CELS_LINKED || spec.cels == CELS_CHAINED) && frame % 4)
+		{
+			putUInt16(1);
+			putZeros(7);
+			putUInt16(spec.cels == CELS_CHAINED ? frame - 1 : frame - frame % 4);
+			return endChunk(chunk);
+		}
+
+		putUInt16(spec.cels == CELS_RAW ? 0 : 2);
+		putZeros(7);
+		putUInt16(w);
+		putUInt16(h);
+
+		std::vector<uint8_t> pixels = makePixels(frame, layer, w, h, bytesPerPixel);
+		if (spec.cels == CELS_RAW)
+		{
+			out.insert(out.end(), pixels.begin(), pixels.end());
+		}
+		else
+		{
+			uLongf length = compressBound(pixels.size());
+			const size_t at = out.size();
+			out.resize(at + length);
+			compress2(out.data() + at, &length, pixels.data(), pixels.size(), Z_DEFAULT_COMPRESSION);
+			out.resize(at + length);
+		}
+		return endChunk(chunk);
+	}
+
+	// Flat blocks of color shifting with the frame, a transparent border and
+	// a pixel of noise here and there
+	std::vector<uint8_t> makePixels(int frame, int layer, int w, int h, int bytesPerPixel)
+	{
+		std::vector<uint8_t> pixels((size_t)w * h * bytesPerPixel);
+		uint8_t *p = pixels.data();
+
+		for (int y = 0; y < h; y++)
+		{
+			for (int x = 0; x < w; x++, p += bytesPerPixel)
+			{
+				const bool empty = layer && (x < w / 8 || x >= w - w / 8);
+				uint32_t value = ((x + frame) / 6 * 7 + (y / 5) * 13 + layer * 31) & 0xff;
+				if (random() % 16 == 0)
+					value = random() & 0xff;
+
+				switch (bytesPerPixel)
+				{
+				case 1:
+					p[0] = empty ? 0 : (uint8_t)(value | 1);
+					break;
+				case 2:
+					p[0] = (uint8_t)value;
+					p[1] = empty ? 0 : 255;
+					break;
+				default:
+					p[0] = (uint8_t)value;
+					p[1] = (uint8_t)(value * 3);
+					p[2] = (uint8_t)(255 - value);
+					p[3] = empty ? 0 : 255;
+				}
+			}
+		}
+		return pixels;
+	}
+};
+
+inline std::vector<uint8_t> generateAseprite(const CorpusSpec &spec)
+{
+	return CorpusWriter(spec).write();
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "../src/aseprite-blend.h"
+
+// Blend row micro-benchmark: megapixels per second of blendRowScalar and
+// blendRow for every blend mode, and the largest channel difference
+// between both.
+
+static const char *MODE_NAMES[] = {
+	"normal", "multiply", "screen", "overlay", "darken", "lighten",
+	"color-dodge", "color-burn", "hard-light", "soft-light", "difference",
+	"exclusion", "hue", "saturation", "color", "luminosity", "addition",
+	"subtract", "divide",
+};
+
+static const int ROW = 1024;
+static const int ROWS = 64;
+
+// Random pixels, with a good share of fully transparent and opaque alpha
+static void fill(std::vector<uint8_t> &pixels)
+{
+	for (size_t i = 0; i < pixels.size(); i += 4)
+	{
+		pixels[i] = rand() & 0xff;
+		pixels[i + 1] = rand() & 0xff;
+		pixels[i + 2] = rand() & 0xff;
+		int a = rand() % 4;
+		pixels[i + 3] = a == 0 ? 0 : a == 1 ? 255 : rand() & 0xff;
+	}
+}
+
+template <typename Fn>
+static double measure(Fn fn, std::vector<uint8_t> &dst, const std::vector<uint8_t> &backdrop, const std::vector<uint8_t> &src)
+{
+	int iterations = 0;
+	double elapsed = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	while (elapsed < 0.2)
+	{
+		memcpy(dst.data(), backdrop.data(), dst.size());
+		for (int y = 0; y < ROWS; y++)
+			fn(dst.data() + y * ROW * 4, src.data() + y * ROW * 4);
+		iterations++;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	return (double)iterations * ROW * ROWS / elapsed / 1e6;
+}
+
+int main()
+{
+	std::vector<uint8_t> backdrop(ROW * ROWS * 4), src(ROW * ROWS * 4);
+	std::vector<uint8_t> scalar(backdrop.size()), fast(backdrop.size());
+	srand(1);
+	fill(backdrop);
+	fill(src);
+
+	printf("Kernel: %s\n", blendRowKernel());
+	printf("%-12s %12s %12s %9s\n", "mode", "scalar MP/s", "kernel MP/s", "max diff");
+
+	int worst = 0;
+	for (int m = 0; m < 19; m++)
+	{
+		auto mode = static_cast<AsepriteReader::BlendMode>(m);
+		const int opacity = 200;
+
+		// correctness against the reference
+		memcpy(scalar.data(), backdrop.data(), scalar.size());
+		memcpy(fast.data(), backdrop.data(), fast.size());
+		blendRowScalar(mode, scalar.data(), src.data(), ROW * ROWS, opacity);
+		blendRow(mode, fast.data(), src.data(), ROW * ROWS, opacity);
+
+		int diff = 0;
+		for (size_t i = 0; i < scalar.size(); i++)
+			diff = std::max(diff, abs(scalar[i] - fast[i]));
+		worst = std::max(worst, diff);
+
+		double scalarRate = measure([&](uint8_t *d, const uint8_t *s)
+									{ blendRowScalar(mode, d, s, ROW, opacity); },
+									scalar, backdrop, src);
+		double fastRate = measure([&](uint8_t *d, const uint8_t *s)
+								  { blendRow(mode, d, s, ROW, opacity); },
+								  fast, backdrop, src);
+
+		printf("%-12s %12.1f %12.1f %9d\n", MODE_NAMES[m], scalarRate, fastRate, diff);
+	}
+
+	if (worst > 1)
+	{
+		printf("Fail: kernel differs from the reference by %d\n", worst);
+		return 1;
+	}
+
+	printf("Success\n");
+	return 0;
+}
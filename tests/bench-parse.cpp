@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+#include "../src/aseprite-reader.h"
+#include "aseprite-corpus.h"
+
+// Parser benchmark over synthetic files: MB/s, cels/s, operator new calls
+// per load and peak RSS of AsepriteReader::load, one case per axis.
+//
+//   bench-parse [--json] [--threads N] [filter]   run the cases whose name contains `filter`
+//   bench-parse --write DIR                      write the corpus for tests/bench-parse.js
+
+static std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size)
+{
+	allocations++;
+	if (void *p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static std::vector<CorpusSpec> corpus()
+{
+	std::vector<CorpusSpec> specs;
+	auto base = [](const char *name)
+	{
+		CorpusSpec spec;
+		spec.name = name;
+		spec.tags = 2;
+		spec.slices = 2;
+		return spec;
+	};
+
+	specs.push_back(base("base"));
+
+	CorpusSpec canvas16 = base("canvas-16");
+	canvas16.width = 16;
+	canvas16.height = 16;
+	specs.push_back(canvas16);
+
+	CorpusSpec canvas256 = base("canvas-256");
+	canvas256.width = 256;
+	canvas256.height = 256;
+	specs.push_back(canvas256);
+
+	CorpusSpec canvas1024 = base("canvas-1024");
+	canvas1024.width = 1024;
+	canvas1024.height = 1024;
+	canvas1024.frames = 4;
+	specs.push_back(canvas1024);
+
+	CorpusSpec frames = base("frames-256");
+	frames.frames = 256;
+	specs.push_back(frames);
+
+	CorpusSpec layers = base("layers-32");
+	layers.layers = 32;
+	specs.push_back(layers);
+
+	CorpusSpec depth8 = base("depth-8");
+	depth8.colorDepth = 8;
+	specs.push_back(depth8);
+
+	CorpusSpec depth16 = base("depth-16");
+	depth16.colorDepth = 16;
+	specs.push_back(depth16);
+
+	CorpusSpec raw = base("cels-raw");
+	raw.cels = CELS_RAW;
+	specs.push_back(raw);
+
+	CorpusSpec linked = base("cels-linked");
+	linked.cels = CELS_LINKED;
+	specs.push_back(linked);
+
+	CorpusSpec tagsSlices = base("tags-slices-500");
+	tagsSlices.tags = 500;
+	tagsSlices.slices = 500;
+	specs.push_back(tagsSlices);
+
+	return specs;
+}
+
+// Peak resident set of the process so far, in KB
+static long peakRSS()
+{
+#if defined(__APPLE__)
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024;
+#elif defined(__unix__)
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+#else
+	return 0;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	bool json = false;
+	unsigned threads = 1;
+	const char *filter = "";
+	const char *writeDir = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--json"))
+			json = true;
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--write") && i + 1 < argc)
+			writeDir = argv[++i];
+		else
+			filter = argv[i];
+	}
+
+	if (writeDir)
+	{
+		for (const CorpusSpec &spec : corpus())
+		{
+			std::vector<uint8_t> data = generateAseprite(spec);
+			std::string path = std::string(writeDir) + "/" + spec.name + ".aseprite";
+			FILE *out = fopen(path.c_str(), "wb");
+			if (!out || fwrite(data.data(), 1, data.size(), out) != data.size())
+			{
+				printf("Fail: cannot write %s\n", path.c_str());
+				return 1;
+			}
+			fclose(out);
+			printf("%s: %zu bytes\n", path.c_str(), data.size());
+		}
+		return 0;
+	}
+
+	if (!json)
+		printf("%-16s %10s %10s %10s %12s %10s %10s\n", "case", "bytes", "ms/load", "MB/s", "cels/s", "allocs", "peak KB");
+
+	for (const CorpusSpec &spec : corpus())
+	{
+		if (!strstr(spec.name.c_str(), filter))
+			continue;
+
+		const std::vector<uint8_t> data = generateAseprite(spec);
+		size_t cels = 0;
+		size_t loadAllocations = 0;
+		int iterations = 0;
+		double elapsed = 0;
+
+		try
+		{
+			// The first load checks the output and counts allocations
+			{
+				AsepriteReader reader;
+				reader.options.threads = threads;
+				const size_t before = allocations;
+				reader.load(data.data(), (uint32_t)data.size());
+				loadAllocations = allocations - before;
+				cels = reader.file.cels.size();
+
+				if (reader.file.frames.size() != (size_t)spec.frames || cels != (size_t)spec.frames * spec.layers)
+				{
+					printf("Fail: %s parsed into %zu frames and %zu cels\n", spec.name.c_str(), reader.file.frames.size(), cels);
+					return 1;
+				}
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			while (elapsed < 0.5 || iterations < 3)
+			{
+				AsepriteReader reader;
+				reader.options.threads = threads;
+				reader.load(data.data(), (uint32_t)data.size());
+				iterations++;
+				elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+		}
+		catch (const std::exception &e)
+		{
+			printf("Fail: %s: %s\n", spec.name.c_str(), e.what());
+			return 1;
+		}
+
+		const double seconds = elapsed / iterations;
+		const double mbps = data.size() / seconds / 1e6;
+		const double celsps = cels / seconds;
+
+		if (json)
+		{
+			printf("{\"case\":\"%s\",\"width\":%d,\"height\":%d,\"frames\":%d,\"layers\":%d,\"colorDepth\":%d,"
+				   "\"cels\":\"%s\",\"tags\":%d,\"slices\":%d,\"threads\":%u,\"bytes\":%zu,\"loads\":%d,"
+				   "\"msPerLoad\":%.4f,\"mbPerSecond\":%.2f,\"celsPerSecond\":%.0f,\"allocations\":%zu,\"peakRssKB\":%ld}\n",
+				   spec.name.c_str(), spec.width, spec.height, spec.frames, spec.layers, spec.colorDepth,
+				   spec.cels == CELS_RAW ? "raw" : spec.cels == CELS_LINKED ? "linked" : spec.cels == CELS_CHAINED ? "chained" : "compressed",
+				   spec.tags, spec.slices, threads, data.size(), iterations,
+				   seconds * 1e3, mbps, celsps, loadAllocations, peakRSS());
+		}
+		else
+		{
+			printf("%-16s %10zu %10.3f %10.1f %12.0f %10zu %10ld\n", spec.name.c_str(), data.size(), seconds * 1e3, mbps, celsps, loadAllocations, peakRSS());
+		}
+	}
+
+	if (!json)
+		printf("Success\n");
+	return 0;
+}
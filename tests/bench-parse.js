@@ -0,0 +1,123 @@
+// Parser benchmark of the Node binding, over the synthetic corpus written by
+// `bench-parse --write DIR` (see tests/bench-parse.cpp):
+//
+//   node tests/bench-parse.js [--json] [DIR]
+//
+// Reports MB/s and cels/s of the default export, readAsepriteFile and
+// readAsepriteInfo. Each case runs in a process of its own, so that its
+// peak RSS is its own. One load per loader, result kept alive, gives the JS
+// heap and external (native pixels) memory it holds.
+
+const childProcess = require('child_process');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const readAseprite = require('../index');
+
+const args = process.argv.slice(2);
+const json = args.includes('--json');
+const caseIndex = args.indexOf('--case');
+const only = caseIndex >= 0 ? args[caseIndex + 1] : null;
+const dir = args.find((arg, i) => !arg.startsWith('--') && (caseIndex < 0 || i !== caseIndex + 1)) || path.join(os.tmpdir(), 'aseprite-corpus');
+
+if (!fs.existsSync(dir)) {
+	console.error(`No corpus in ${dir}, write one with: bench-parse --write ${dir}`);
+	process.exit(1);
+}
+
+// Loads per second, over half a second at least
+function measure(fn) {
+	let loads = 0;
+	const start = process.hrtime.bigint();
+	let elapsed = 0;
+	while (elapsed < 0.5 || loads < 3) {
+		fn();
+		loads++;
+		elapsed = Number(process.hrtime.bigint() - start) / 1e9;
+	}
+	return { loads, seconds: elapsed / loads };
+}
+
+// Collects, then lets the finalizers of freed buffers run. Needs --expose-gc.
+async function settle() {
+	global.gc();
+	await new Promise(resolve => setImmediate(resolve));
+	global.gc();
+}
+
+// Memory held by the result of one load, in KB
+let kept = null;
+async function retained(fn) {
+	await settle();
+	const before = process.memoryUsage();
+	kept = fn();
+	await settle();
+	const after = process.memoryUsage();
+	kept = null;
+
+	const kb = bytes => Math.max(0, Math.round(bytes / 1024));
+	return { heapKB: kb(after.heapUsed - before.heapUsed), externalKB: kb(after.external - before.external) };
+}
+
+const loaders = {
+	buffer: (file, buffer) => readAseprite(buffer),
+	file: (file) => readAseprite.readAsepriteFile(file),
+	info: (file, buffer) => readAseprite.readAsepriteInfo(buffer),
+};
+
+async function runCase(name) {
+	const file = path.join(dir, name);
+	const buffer = fs.readFileSync(file);
+	const cels = readAseprite.readAsepriteInfo(buffer).cels.length;
+	const results = [];
+
+	for (const [loader, fn] of Object.entries(loaders)) {
+		fn(file, buffer);
+		const { heapKB, externalKB } = await retained(() => fn(file, buffer));
+		const { loads, seconds } = measure(() => fn(file, buffer));
+		results.push({
+			case: path.basename(name, '.aseprite'),
+			loader,
+			bytes: buffer.length,
+			loads,
+			msPerLoad: +(seconds * 1e3).toFixed(4),
+			mbPerSecond: +(buffer.length / seconds / 1e6).toFixed(2),
+			celsPerSecond: Math.round(cels / seconds),
+			heapKB,
+			externalKB,
+			peakRssKB: process.resourceUsage().maxRSS,
+		});
+	}
+	return results;
+}
+
+function runAll() {
+	if (!json) {
+		console.log(['case', 'loader', 'bytes', 'ms/load', 'MB/s', 'cels/s', 'heap KB', 'ext KB', 'peak KB'].map(s => s.padStart(12)).join(''));
+	}
+
+	for (const name of fs.readdirSync(dir).filter(name => name.endsWith('.aseprite')).sort()) {
+		const output = childProcess.execFileSync(process.execPath, ['--expose-gc', __filename, '--case', name, dir], { encoding: 'utf8' });
+
+		for (const line of output.split('\n').filter(line => line)) {
+			const result = JSON.parse(line);
+			if (json) {
+				console.log(line);
+			} else {
+				console.log([result.case, result.loader, result.bytes, result.msPerLoad.toFixed(3), result.mbPerSecond.toFixed(1), result.celsPerSecond, result.heapKB, result.externalKB, result.peakRssKB]
+					.map(s => String(s).padStart(12)).join(''));
+			}
+		}
+	}
+}
+
+if (only) {
+	// Child of runAll: one case, as JSON
+	runCase(only).then(results => {
+		for (const result of results) {
+			console.log(JSON.stringify(result));
+		}
+	});
+} else {
+	runAll();
+}
@@ -0,0 +1,189 @@
+/*
+ * fuzz-reader.cpp
+ *
+ *  Fuzz target for the parsers: full, metadata, lazy, selective (with dedup)
+ *  and indexed loads, the stream parser and frame rendering all run on each input.
+ *  Built with address sanitizer, any read out of bounds aborts. Define
+ *  ASEPRITE_LIBFUZZER when linking with -fsanitize=fuzzer, otherwise the
+ *  files given on the command line are run along with mutations of each
+ *  (see the README).
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "../src/aseprite-reader.h"
+#include "../src/aseprite-stream.h"
+
+// Decoding allocates what the headers ask for, inputs asking for more are
+// only parsed
+static const size_t PIXEL_BUDGET = 16 << 20;
+
+static size_t pixelBytes(const AsepriteReader::AsepriteFile &file)
+{
+	size_t bytes = (size_t)file.width * file.height * 4;
+	for (const AsepriteReader::Cel *cel : file.cels)
+		bytes += (size_t)cel->w * cel->h * 4;
+	for (const AsepriteReader::Tileset *tileset : file.tilesets)
+		bytes += (size_t)tileset->tileWidth * tileset->tileHeight * tileset->numTiles * 4;
+	return bytes;
+}
+
+static void fuzzOne(const uint8_t *data, size_t size)
+{
+	// A private copy, so that reads past the end land in a redzone
+	std::vector<uint8_t> input(data, data + size);
+	const uint8_t *in = input.data();
+	const uint32_t length = (uint32_t)size;
+
+	AsepriteReader metadata;
+	try
+	{
+		metadata.loadMetadata(in, length);
+	}
+	catch (const std::exception &)
+	{
+		return;
+	}
+	if (pixelBytes(metadata.file) > PIXEL_BUDGET)
+		return;
+
+	try
+	{
+		AsepriteReader reader;
+		reader.load(in, length);
+		if (!reader.file.frames.empty() && reader.file.width && reader.file.height)
+		{
+			std::vector<uint8_t> canvas((size_t)reader.file.width * reader.file.height * 4);
+			reader.renderFrame(0, canvas.data(), true);
+		}
+	}
+	catch (const std::exception &)
+	{
+	}
+
+	try
+	{
+		AsepriteReader lazy;
+		lazy.options.lazy = true;
+		lazy.load(in, length);
+		for (AsepriteReader::Cel *cel : lazy.file.cels)
+			cel->getPixels();
+	}
+	catch (const std::exception &)
+	{
+	}
+
+	try
+	{
+		AsepriteReader selective;
+		selective.options.firstFrame = 1;
+		selective.options.visibleOnly = true;
+		selective.options.dedup = true;
+		selective.load(in, length);
+	}
+	catch (const std::exception &)
+	{
+	}
+
+	try
+	{
+		const AsepriteReader::FrameIndex index = AsepriteReader::buildFrameIndex(in, length);
+		const std::vector<uint8_t> serialized = index.serialize();
+		AsepriteReader::FrameIndex::deserialize(serialized.data(), serialized.size());
+
+		if (!index.frames.empty())
+		{
+			const unsigned last = (unsigned)index.frames.size() - 1;
+			AsepriteReader frames;
+			frames.loadFrames(in, length, index, last, last);
+		}
+	}
+	catch (const std::exception &)
+	{
+	}
+
+	try
+	{
+		// Frame index blobs come from users as well
+		AsepriteReader::FrameIndex::deserialize(in, size);
+	}
+	catch (const std::exception &)
+	{
+	}
+
+	try
+	{
+		AsepriteStreamParser parser;
+		for (size_t offset = 0; offset < size; offset += 7)
+			parser.write(in + offset, std::min<size_t>(7, size - offset));
+		parser.end();
+	}
+	catch (const std::exception &)
+	{
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	fuzzOne(data, size);
+	return 0;
+}
+
+#ifndef ASEPRITE_LIBFUZZER
+
+// Deterministic, so that a failing run can be repeated
+static uint32_t nextRandom(uint32_t &state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned MUTATIONS = 2000;
+
+	for (int i = 1; i < argc; i++)
+	{
+		FILE *f = fopen(argv[i], "rb");
+		if (!f)
+		{
+			printf("Fail: cannot open %s\n", argv[i]);
+			return 1;
+		}
+		std::vector<uint8_t> seed;
+		uint8_t buffer[4096];
+		size_t read;
+		while ((read = fread(buffer, 1, sizeof(buffer), f)) > 0)
+			seed.insert(seed.end(), buffer, buffer + read);
+		fclose(f);
+
+		fuzzOne(seed.data(), seed.size());
+
+		uint32_t state = 0x9e3779b9u + i;
+		for (unsigned m = 0; m < MUTATIONS && !seed.empty(); m++)
+		{
+			std::vector<uint8_t> input = seed;
+
+			// A few bytes overwritten, mostly in headers, then maybe a cut
+			const unsigned edits = 1 + nextRandom(state) % 8;
+			for (unsigned e = 0; e < edits; e++)
+			{
+				const size_t span = (nextRandom(state) & 1) ? std::min<size_t>(input.size(), 1024) : input.size();
+				input[nextRandom(state) % span] = (uint8_t)nextRandom(state);
+			}
+			if (nextRandom(state) % 4 == 0)
+				input.resize(nextRandom(state) % input.size());
+
+			fuzzOne(input.data(), input.size());
+		}
+		printf("%s: %u mutations\n", argv[i], MUTATIONS);
+	}
+	return 0;
+}
+
+#endif
@@ -1,24 +1,32 @@
 #include <stdio.h>
-#include <fstream>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
 #include "../src/aseprite-reader.h"
+#include "../src/aseprite-atlas.h"
+#include "../src/aseprite-blend.h"
+#include "../src/aseprite-stream.h"
+#include "../src/mapped-file.h"
+#include "../src/parse-cache.h"
+#include "aseprite-corpus.h"
 
-int main(int argc, char **argv)
+int main()
 {
 	AsepriteReader reader;
+	AsepriteReader parallelReader;
+	parallelReader.options.threads = 0;
+	AsepriteReader lazyReader;
+	lazyReader.options.lazy = true;
+	AsepriteReader rgbaReader;
+	rgbaReader.options.rgba = true;
 
 	try
 	{
-		uint32_t size;
-		std::ifstream in;
-		in.open("test.aseprite");
-		in.seekg(0, std::ios::end);
-		size = in.tellg();
-		in.seekg(0, std::ios::beg);
-		char *buffer = new char[size];
-		in.read(buffer, size);
-		in.close();
-
-		reader.load((uint8_t *)buffer, size);
+		reader.loadFile("test.aseprite");
+		parallelReader.loadFile("test.aseprite");
+		lazyReader.loadFile("test.aseprite");
+		rgbaReader.loadFile("test.aseprite");
 	}
 	catch (const std::exception &e)
 	{
@@ -41,10 +49,261 @@ int main(int argc, char **argv)
 	printf("Palette:\n");
 	for (auto &color : reader.file.palette->colors)
 	{
-		printf("\e[48;2;%d;%d;%dm  \e[0m", color->r, color->g, color->b);
+		printf("\e[48;2;%d;%d;%dm  \e[0m", color.r, color.g, color.b);
 	}
 	printf("\n");
 
+	for (size_t i = 0; i < reader.file.cels.size(); i++)
+	{
+		auto &cel = reader.file.cels[i];
+		if (memcmp(cel->pixels.get(), parallelReader.file.cels[i]->pixels.get(), cel->pixelsLength))
+		{
+			printf("Fail: parallel decompression differs on cel %zu\n", i);
+			return 1;
+		}
+		if (memcmp(cel->pixels.get(), lazyReader.file.cels[i]->getPixels().get(), cel->pixelsLength))
+		{
+			printf("Fail: lazy decompression differs on cel %zu\n", i);
+			return 1;
+		}
+		if (memcmp(reader.toRGBA(cel).get(), rgbaReader.file.cels[i]->pixels.get(), (size_t)cel->w * cel->h * 4))
+		{
+			printf("Fail: RGBA conversion differs on cel %zu\n", i);
+			return 1;
+		}
+	}
+
+	std::vector<uint8_t> frame(reader.file.width * reader.file.height * 4);
+	reader.renderFrame(0, frame.data());
+	int opaque = 0;
+	for (size_t i = 3; i < frame.size(); i += 4)
+	{
+		if (frame[i])
+			opaque++;
+	}
+	printf("Frame 0: %d visible pixels\n", opaque);
+
+	AtlasOptions atlasOptions;
+	atlasOptions.padding = 1;
+	Atlas atlas = packAtlas({&reader, &lazyReader}, atlasOptions);
+	printf("Atlas: %zu frames on %zu page(s), first page %dx%d\n", atlas.frames.size(), atlas.pages.size(), atlas.pages[0].width, atlas.pages[0].height);
+
+	// The same lazy sprite twice, on several threads, packs like two copies
+	AsepriteReader twiceReader;
+	twiceReader.options.lazy = true;
+	twiceReader.loadFile("test.aseprite");
+	atlasOptions.threads = 4;
+	Atlas twice = packAtlas({&twiceReader, &twiceReader}, atlasOptions);
+	const size_t half = twice.frames.size() / 2;
+	for (size_t i = 0; i < half; i++)
+	{
+		const AtlasFrame &a = twice.frames[i];
+		const AtlasFrame &b = twice.frames[half + i];
+		if (b.sprite != 1 || b.frame != a.frame || b.w != a.w || b.h != a.h)
+		{
+			printf("Fail: atlas of a sprite listed twice\n");
+			return 1;
+		}
+	}
+	printf("Atlas twice: %zu frames on %zu page(s)\n", twice.frames.size(), twice.pages.size());
+
+	// Stream the file in small chunks, as if it came from the network
+	MappedFile mapped;
+	mapped.open("test.aseprite");
+	AsepriteStreamParser stream;
+	unsigned streamedCels = 0;
+	stream.onCel = [&](AsepriteReader::Cel *)
+	{ streamedCels++; };
+
+	try
+	{
+		for (size_t i = 0; i < mapped.size(); i += 100)
+			stream.write(mapped.data() + i, std::min<size_t>(100, mapped.size() - i));
+		stream.end();
+	}
+	catch (const std::exception &e)
+	{
+		printf("Fail: %s\n", e.what());
+		return 1;
+	}
+
+	if (streamedCels != reader.file.cels.size())
+	{
+		printf("Fail: streamed %u cels instead of %zu\n", streamedCels, reader.file.cels.size());
+		return 1;
+	}
+	printf("Stream: %u cels in %zu frames\n", streamedCels, stream.reader().file.frames.size());
+
+	// The second load of the same bytes comes from the cache
+	ParseCache cache(64 << 20);
+	const uint64_t key = ParseCache::bufferKey(mapped.data(), mapped.size(), AsepriteReader::LoadOptions());
+	for (int i = 0; i < 2; i++)
+	{
+		if (!cache.find(key))
+		{
+			std::shared_ptr<AsepriteReader> parsed = std::make_shared<AsepriteReader>();
+			parsed->load(mapped.data(), mapped.size());
+			cache.insert(key, parsed);
+		}
+	}
+	ParseCache::Stats stats = cache.stats();
+	printf("Cache: %llu hit(s), %llu miss(es), %zu bytes\n", (unsigned long long)stats.hits, (unsigned long long)stats.misses, stats.bytes);
+
+	AsepriteReader statsReader;
+	statsReader.options.stats = true;
+	statsReader.load(mapped.data(), mapped.size());
+	const AsepriteReader::ChunkStats &celChunks = statsReader.stats.chunks[0x2005];
+	printf("Stats: %u cel chunks, %llu -> %llu bytes inflated\n", celChunks.count, (unsigned long long)statsReader.stats.compressedBytes, (unsigned long long)statsReader.stats.decompressedBytes);
+
+	// Only the cels of one tag, the others are never decoded
+	AsepriteReader tagReader;
+	tagReader.options.tags.push_back(reader.file.tags.back()->name);
+	tagReader.load(mapped.data(), mapped.size());
+	for (auto &cel : tagReader.file.cels)
+	{
+		const int frameIndex = (int)(std::find(tagReader.file.frames.begin(), tagReader.file.frames.end(), cel->frame) - tagReader.file.frames.begin());
+		if (frameIndex < reader.file.tags.back()->frameFrom || frameIndex > reader.file.tags.back()->frameTo)
+		{
+			printf("Fail: cel of frame %d outside of tag %s\n", frameIndex, reader.file.tags.back()->name.c_str());
+			return 1;
+		}
+	}
+	printf("Tag %s: %zu of %zu cels\n", reader.file.tags.back()->name.c_str(), tagReader.file.cels.size(), reader.file.cels.size());
+
+	// Links into skipped frames, through a skipped linked cel, get the data
+	// of the cel holding it
+	CorpusSpec chainSpec;
+	chainSpec.cels = CELS_CHAINED;
+	const std::vector<uint8_t> chainFile = generateAseprite(chainSpec);
+	AsepriteReader chainReader, chainTail, chainLazy;
+	chainTail.options.firstFrame = chainLazy.options.firstFrame = 2;
+	chainLazy.options.lazy = true;
+	chainReader.load(chainFile.data(), (uint32_t)chainFile.size());
+	chainTail.load(chainFile.data(), (uint32_t)chainFile.size());
+	chainLazy.load(chainFile.data(), (uint32_t)chainFile.size());
+	for (size_t i = 0; i < chainTail.file.cels.size(); i++)
+	{
+		const AsepriteReader::Cel *cel = chainTail.file.cels[i];
+		const size_t frameIndex = std::find(chainTail.file.frames.begin(), chainTail.file.frames.end(), cel->frame) - chainTail.file.frames.begin();
+		const AsepriteReader::Cel *expected = chainReader.file.frames[frameIndex]->cels[cel->layer->index];
+		if (!cel->pixels || cel->pixelsLength != expected->pixelsLength || memcmp(cel->pixels.get(), expected->pixels.get(), cel->pixelsLength) ||
+			memcmp(chainLazy.file.cels[i]->getPixels().get(), expected->pixels.get(), cel->pixelsLength))
+		{
+			printf("Fail: cel %zu linked into skipped frames differs\n", i);
+			return 1;
+		}
+	}
+	printf("Links: %zu of %zu cels from frame 2 on\n", chainTail.file.cels.size(), chainReader.file.cels.size());
+
+	// One frame through a serialized index, the others are not parsed
+	const std::vector<uint8_t> indexBytes = AsepriteReader::buildFrameIndex(mapped.data(), mapped.size()).serialize();
+	AsepriteReader frameReader;
+	frameReader.loadFrames(mapped.data(), mapped.size(), AsepriteReader::FrameIndex::deserialize(indexBytes.data(), indexBytes.size()), 5, 5);
+	for (size_t i = 0; i < frameReader.file.frames[5]->cels.size(); i++)
+	{
+		AsepriteReader::Cel *cel = frameReader.file.frames[5]->cels[i];
+		AsepriteReader::Cel *expected = reader.file.frames[5]->cels[i];
+		if (!cel != !expected || (cel && memcmp(cel->pixels.get(), expected->pixels.get(), cel->pixelsLength)))
+		{
+			printf("Fail: frame 5 differs in layer %zu\n", i);
+			return 1;
+		}
+	}
+	printf("Frame 5: %zu of %zu cels, index %zu bytes\n", frameReader.file.cels.size(), reader.file.cels.size(), indexBytes.size());
+
+	// The range narrows the selection in options, and leaves it as it was
+	AsepriteReader rangeReader;
+	rangeReader.options.lastFrame = 3;
+	rangeReader.loadFrames(mapped.data(), mapped.size(), AsepriteReader::FrameIndex::deserialize(indexBytes.data(), indexBytes.size()), 5, 5);
+	if (!rangeReader.file.cels.empty() || rangeReader.options.firstFrame != 0 || rangeReader.options.lastFrame != 3)
+	{
+		printf("Fail: frame range replaced the frames option\n");
+		return 1;
+	}
+
+	// Converted while decoding: RGBA with red and blue swapped
+	AsepriteReader bgraReader;
+	bgraReader.options.format = AsepriteReader::PixelFormat::BGRA8;
+	bgraReader.load(mapped.data(), mapped.size());
+	for (size_t i = 0; i < bgraReader.file.cels.size(); i++)
+	{
+		const uint8_t *bgra = bgraReader.file.cels[i]->pixels.get();
+		const uint8_t *rgba = rgbaReader.file.cels[i]->pixels.get();
+		for (size_t p = 0; p < bgraReader.file.cels[i]->pixelsLength; p += 4)
+		{
+			if (bgra[p] != rgba[p + 2] || bgra[p + 1] != rgba[p + 1] || bgra[p + 2] != rgba[p] || bgra[p + 3] != rgba[p + 3])
+			{
+				printf("Fail: BGRA conversion differs on cel %zu\n", i);
+				return 1;
+			}
+		}
+	}
+	printf("Format %s: depth %d, %zu bytes in first cel\n", AsepriteReader::pixelFormatName(bgraReader.file.pixelFormat), bgraReader.file.colorDepth, bgraReader.file.cels[0]->pixelsLength);
+
+	// Repeated cels share one copy of their pixels
+	AsepriteReader dedupReader;
+	dedupReader.options.dedup = true;
+	dedupReader.options.stats = true;
+	dedupReader.load(mapped.data(), mapped.size());
+	for (size_t i = 0; i < dedupReader.file.cels.size(); i++)
+	{
+		if (memcmp(dedupReader.file.cels[i]->pixels.get(), reader.file.cels[i]->pixels.get(), reader.file.cels[i]->pixelsLength))
+		{
+			printf("Fail: dedup differs on cel %zu\n", i);
+			return 1;
+		}
+	}
+	printf("Dedup: %u cels share pixels, %llu of %llu bytes saved\n", dedupReader.stats.dedupCels, (unsigned long long)dedupReader.stats.dedupBytes, (unsigned long long)dedupReader.stats.celBytes);
+
+	// A half transparent group is flattened first, then blended as a whole
+	CorpusSpec groupSpec;
+	groupSpec.layers = 3;
+	groupSpec.groupOpacity = 128;
+	const std::vector<uint8_t> groupFile = generateAseprite(groupSpec);
+	AsepriteReader groupReader;
+	groupReader.load(groupFile.data(), (uint32_t)groupFile.size());
+	AsepriteReader::Layer *bottom = groupReader.file.layers[0];
+	AsepriteReader::Layer *group = groupReader.file.layers[1];
+	const size_t groupPixels = (size_t)groupSpec.width * groupSpec.height;
+	std::vector<uint8_t> flattened(groupPixels * 4), below(groupPixels * 4), inside(groupPixels * 4);
+	groupReader.renderFrame(0, flattened.data());
+	group->flags &= ~AsepriteReader::LAYER_FLAG_VISIBLE;
+	groupReader.renderFrame(0, below.data());
+	group->flags |= AsepriteReader::LAYER_FLAG_VISIBLE;
+	group->opacity = 255;
+	bottom->flags &= ~AsepriteReader::LAYER_FLAG_VISIBLE;
+	groupReader.renderFrame(0, inside.data());
+	blendRowScalar(AsepriteReader::BlendMode::NORMAL, below.data(), inside.data(), (int)groupPixels, groupSpec.groupOpacity);
+	for (size_t i = 0; i < below.size(); i++)
+	{
+		if (abs(below[i] - flattened[i]) > 1)
+		{
+			printf("Fail: group opacity differs on pixel %zu\n", i / 4);
+			return 1;
+		}
+	}
+	printf("Group: %zu layers at opacity %d\n", group->layerChildren.size(), groupSpec.groupOpacity);
+
+	// Without the header flag, the opacity stored for layers (0 here) is ignored
+	CorpusSpec opaqueSpec;
+	opaqueSpec.layerOpacity = false;
+	const std::vector<uint8_t> opaqueFile = generateAseprite(opaqueSpec);
+	AsepriteReader opaqueReader;
+	opaqueReader.load(opaqueFile.data(), (uint32_t)opaqueFile.size());
+	const size_t opaquePixels = (size_t)opaqueSpec.width * opaqueSpec.height;
+	std::vector<uint8_t> unflagged(opaquePixels * 4), flagged(opaquePixels * 4);
+	opaqueReader.renderFrame(0, unflagged.data());
+	opaqueReader.file.layerOpacity = true;
+	for (AsepriteReader::Layer *layer : opaqueReader.file.layers)
+		layer->opacity = 255;
+	opaqueReader.renderFrame(0, flagged.data());
+	if (unflagged != flagged || std::all_of(unflagged.begin(), unflagged.end(), [](uint8_t value) { return value == 0; }))
+	{
+		printf("Fail: layers of a file without layer opacity are not opaque\n");
+		return 1;
+	}
+	printf("Layer opacity: ignored without the header flag\n");
+
 	printf("Success\n");
 	return 0;
-};
+}
@@ -1,3 +1,4 @@
+const assert = require('assert');
 const fs = require('fs');
 const path = require('path');
 const readAseprite = require('../index');
@@ -17,3 +18,104 @@ for (const layer of ase.layers) {
 
 console.log('Palette:');
 console.log(ase.palette.colors.map(color => `\x1b[48;2;${color[0]};${color[1]};${color[2]}m  \x1b[0m`).join(''));
+
+readAseprite.readAsepriteAsync(buffer, { threads: 0 }).then(asyncAse => {
+	console.log(`Async: ${asyncAse.frames.length} frames, ${asyncAse.cels.length} cels`);
+});
+
+const mapped = readAseprite.readAsepriteFile(path.join(__dirname, 'test.aseprite'), { lazy: true });
+console.log(`Mapped: ${mapped.frames.length} frames, ${mapped.cels[0].pixels.length} bytes in first cel`);
+
+readAseprite.readAsepriteFileAsync(path.join(__dirname, 'test.aseprite')).then(asyncAse => {
+	console.log(`Mapped async: ${asyncAse.layers.length} layers`);
+});
+
+readAseprite.readAsepriteBatch([buffer, path.join(__dirname, 'test.aseprite'), new Uint8Array(16)]).then(results => {
+	// One result per input, in input order
+	assert.strictEqual(results.length, 3);
+	assert.strictEqual(results[0].aseprite.frames.length, ase.frames.length);
+	assert.strictEqual(results[1].aseprite.frames.length, ase.frames.length);
+	assert(!results[2].aseprite && results[2].error instanceof Error);
+	const parsed = results.filter(result => result.aseprite).length;
+	console.log(`Batch: ${parsed} parsed, ${results.length - parsed} failed (${results[2].error.message})`);
+});
+
+const frameIndex = readAseprite.buildFrameIndex(buffer);
+const single = readAseprite.readAsepriteFrames(path.join(__dirname, 'test.aseprite'), 5, 5, { index: frameIndex });
+console.log(`Frame 5: ${single.frames[5].cels.filter(cel => cel).length} cels, index ${frameIndex.length} bytes`);
+
+const info = readAseprite.readAsepriteInfo(buffer);
+console.log(`Info: ${info.frames.length} frames, ${info.cels.length} cels`);
+
+const lazy = readAseprite(buffer, { lazy: true });
+const lazyCel = lazy.cels[lazy.cels.length - 1];
+console.log(`Lazy: cel ${lazyCel.w}x${lazyCel.h}, ${lazyCel.pixels.length} bytes`);
+lazyCel.releasePixels();
+
+const rgba = readAseprite(buffer, { rgba: true });
+console.log(`RGBA: depth ${rgba.colorDepth}, first cel ${readAseprite.toRGBA(rgba.cels[0]).length} bytes`);
+
+readAseprite.configureCache({ maxBytes: 64 << 20 });
+// Async loads above may go through the cache too, hence a key of our own
+const cacheBefore = readAseprite.cacheStats();
+readAseprite(buffer, { visibleOnly: true });
+const cacheFirst = readAseprite.cacheStats();
+readAseprite(buffer, { visibleOnly: true });
+const cacheStats = readAseprite.cacheStats();
+assert(cacheFirst.misses > cacheBefore.misses, 'first load is a miss');
+assert(cacheStats.hits > cacheFirst.hits, 'second load is a hit');
+assert(cacheStats.entries > 0 && cacheStats.bytes > 0);
+console.log(`Cache: ${cacheStats.hits} hit(s), ${cacheStats.misses} miss(es), ${cacheStats.bytes} bytes`);
+const cacheOff = readAseprite.configureCache({ maxBytes: 0 });
+assert.strictEqual(cacheOff.entries, 0);
+assert.strictEqual(cacheOff.bytes, 0);
+
+const statsAse = readAseprite(buffer, { stats: true });
+console.log(`Stats: ${statsAse.stats.chunks.cel.count} cel chunks, ${statsAse.stats.jsObjects} JS objects, ratio ${statsAse.stats.compressionRatio.toFixed(1)}`);
+
+const graph = readAseprite(buffer, { stats: true });
+console.log(`Graph: ${graph.stats.jsObjects} JS objects before access, shared frames ${graph.frames.includes(graph.cels[0].frame)}`);
+
+const lastTag = ase.tags[ase.tags.length - 1];
+const selected = readAseprite(buffer, { tags: lastTag.name, visibleOnly: true });
+console.log(`Tag ${lastTag.name}: ${selected.cels.length} of ${ase.cels.length} cels`);
+
+const rgb565 = readAseprite(buffer, { format: 'rgb565' });
+console.log(`Format ${rgb565.pixelFormat}: depth ${rgb565.colorDepth}, ${rgb565.cels[0].pixels.length} bytes in first cel`);
+
+const dedup = readAseprite(buffer, { dedup: true, stats: true });
+console.log(`Dedup: ${dedup.stats.dedupCels} cels share pixels, ratio ${dedup.stats.dedupRatio.toFixed(2)}`);
+
+const compact = readAseprite(buffer, { compact: true });
+console.log(`Compact: ${compact.cels.length / 10} cels, ${compact.pixels.length} pixel bytes, ${compact.layerNames.join(', ')}`);
+
+const frame = ase.renderFrame(0);
+let opaque = 0;
+for (let i = 3; i < frame.length; i += 4) {
+	if (frame[i]) opaque++;
+}
+console.log(`Frame 0: ${opaque} visible pixels`);
+
+const atlas = readAseprite.packAtlas([ase, lazy], { padding: 1 });
+console.log(`Atlas: ${atlas.pages.length} page(s), first ${atlas.pages[0].width}x${atlas.pages[0].height}`);
+
+(async () => {
+	let streamedCels = 0;
+	const stream = fs.createReadStream(path.join(__dirname, 'test.aseprite'), { highWaterMark: 256 });
+	for await (const event of stream.pipe(readAseprite.createAsepriteStream())) {
+		if (event.type === 'cel') streamedCels++;
+		if (event.type === 'end') console.log(`Stream: ${streamedCels} cels in ${event.aseprite.frames.length} frames`);
+	}
+})();
+
+(async () => {
+	// Cel events carry converted pixels, the header tells their layout
+	let header;
+	const stream = fs.createReadStream(path.join(__dirname, 'test.aseprite'), { highWaterMark: 256 });
+	for await (const event of stream.pipe(readAseprite.createAsepriteStream({ format: 'rgb565' }))) {
+		if (event.type === 'header') header = event.header;
+		if (event.type === 'cel' && !event.cel.tilemap) assert.strictEqual(event.cel.pixels.length, event.cel.w * event.cel.h * header.pixelDepth / 8);
+	}
+	assert.strictEqual(header.pixelFormat, 'rgb565');
+	console.log(`Stream ${header.pixelFormat}: ${header.pixelDepth} bits per pixel, file depth ${header.colorDepth}`);
+})();